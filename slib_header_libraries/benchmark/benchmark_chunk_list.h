@@ -2,13 +2,20 @@
 
 using namespace synchronization;
 
+ChunkList<int, 10> bm_chunk_list;
+
 void BM_chunklist(benchmark::State& state) {
-  ChunkList<int, 10> chunk_list;
+  if (state.thread_index() == 0) {
+    int value;
+    while (bm_chunk_list.try_pop(value)) {
+    }
+    for (int64_t i = 0; i < state.range(0); ++i) bm_chunk_list.push_front(1);
+  }
   for (auto _ : state) {
-    benchmark::DoNotOptimize(state.iterations());
-    chunk_list.push_front(2);
-    chunk_list.pop_back();
+    int value;
+    bm_chunk_list.push_front(2);
+    benchmark::DoNotOptimize(bm_chunk_list.try_pop(value));
   }
 }
-// BENCHMARK(BM_chunklist)->ThreadPerCpu();
-BENCHMARK(BM_chunklist)->DenseThreadRange(1, 1);
+BENCHMARK(BM_chunklist)->ThreadPerCpu()->Range(0, 1 << 16);
+BENCHMARK(BM_chunklist)->DenseThreadRange(1, 1)->Range(0, 1 << 16);
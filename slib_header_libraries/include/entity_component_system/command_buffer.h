@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "entity.h"
+
+namespace ecs {
+template <typename EntMgr>
+class CommandBuffer {
+ public:
+  template <typename T>
+  void Add(const Entity& entity, T value) {
+    commands_.emplace_back(
+        [weak = WeakEntity(entity), value = std::move(value)](EntMgr& mgr) {
+          auto entity = weak.Lock();
+          if (!entity.loc_map_) return false;
+          mgr.template AddComponent<T>(entity) = value;
+          return true;
+        });
+  }
+
+  template <typename T>
+  void Write(const Entity& entity, T value) {
+    commands_.emplace_back(
+        [weak = WeakEntity(entity), value = std::move(value)](EntMgr& mgr) {
+          auto entity = weak.Lock();
+          if (!entity.loc_map_) return false;
+          auto comp = mgr.template ComponentW<T>(entity);
+          if (!comp) return false;
+          *comp = value;
+          return true;
+        });
+  }
+
+  template <typename T>
+  void Remove(const Entity& entity) {
+    commands_.emplace_back([weak = WeakEntity(entity)](EntMgr& mgr) {
+      auto entity = weak.Lock();
+      if (!entity.loc_map_ || mgr.template ComponentCount<T>(entity) == 0)
+        return false;
+      mgr.template RemoveComponent<T>(entity);
+      return true;
+    });
+  }
+
+  void Target(const Entity& entity) { targets_.emplace_back(entity); }
+
+  bool TargetsAlive() const {
+    for (auto& target : targets_)
+      if (target.Expired()) return false;
+    return true;
+  }
+
+  size_t Apply(EntMgr& ent_mgr) {
+    size_t applied{0};
+    if (TargetsAlive())
+      for (auto& command : commands_) applied += command(ent_mgr);
+    Clear();
+    return applied;
+  }
+
+  void Clear() {
+    commands_.clear();
+    targets_.clear();
+  }
+
+  size_t size() const { return commands_.size(); }
+  bool empty() const { return commands_.empty(); }
+
+ private:
+  std::vector<std::function<bool(EntMgr&)>> commands_;
+  std::vector<WeakEntity> targets_;
+};
+
+enum class TaskState : std::uint8_t {
+  kRunning,
+  kReady,
+  kApplied,
+  kCancelled
+};
+
+template <typename EntMgr>
+class SystemManager;
+
+template <typename EntMgr>
+class OffloadTask {
+ public:
+  OffloadTask(EntMgr* ent_mgr, std::uint64_t apply_frame)
+      : ent_mgr(ent_mgr), apply_frame(apply_frame) {}
+
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool Cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+  TaskState State() const { return state_.load(std::memory_order_acquire); }
+
+  EntMgr* ent_mgr;
+  std::uint64_t apply_frame;
+  CommandBuffer<EntMgr> commands;
+  std::exception_ptr exception;
+  size_t applied{0};
+
+ private:
+  template <typename>
+  friend class SystemManager;
+
+  std::atomic<bool> cancelled_{false};
+  std::atomic<TaskState> state_{TaskState::kRunning};
+};
+}  // namespace ecs
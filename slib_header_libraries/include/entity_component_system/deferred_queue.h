@@ -0,0 +1,50 @@
+#pragma once
+
+#include <tuple>
+#include <utility>
+
+#include "../tbb_templates.hpp"
+
+namespace ecs {
+template <typename T>
+class DeferredQueue {
+ public:
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    auto it = entries_.emplace_back(tbb_templates::deterministic()
+                                        ? tbb_templates::TaskKeyScope::Next()
+                                        : tbb_templates::TaskKey{},
+                                    size_t(0), T(std::forward<Args>(args)...));
+    it->slot = size_t(it - entries_.begin());
+  }
+
+  void push_back(T value) { emplace_back(std::move(value)); }
+
+  void Canonicalize() {
+    if (!tbb_templates::deterministic() || entries_.size() < 2) return;
+    tbb_templates::parallel_sort(
+        entries_.begin(), entries_.end(),
+        [](const Entry& lhs, const Entry& rhs) {
+          return std::tie(lhs.key, lhs.slot) < std::tie(rhs.key, rhs.slot);
+        });
+  }
+
+  template <typename F>
+  void ForEach(F&& func) {
+    for (size_t i = 0; i < entries_.size(); ++i) func(entries_[i].value);
+  }
+
+  void clear() { entries_.clear(); }
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+ private:
+  struct Entry {
+    tbb_templates::TaskKey key;
+    size_t slot;
+    T value;
+  };
+
+  tbb::concurrent_vector<Entry> entries_;
+};
+}  // namespace ecs
@@ -65,4 +65,28 @@ class Entity {
 
   std::shared_ptr<dsm<std::vector<std::uint64_t>>> loc_map_;
 };
+
+class WeakEntity {
+ public:
+  WeakEntity() = default;
+  WeakEntity(const Entity& entity) : loc_map_(entity.loc_map_) {}
+
+  bool Expired() const { return loc_map_.expired(); }
+
+  Entity Lock() const {
+    Entity entity;
+    entity.loc_map_ = loc_map_.lock();
+    return entity;
+  }
+
+ private:
+  std::weak_ptr<dsm<std::vector<std::uint64_t>>> loc_map_;
+};
 }  // namespace ecs
+
+template <>
+struct std::hash<ecs::Entity> {
+  size_t operator()(const ecs::Entity& entity) const {
+    return std::hash<const void*>{}(entity.loc_map_.get());
+  }
+};
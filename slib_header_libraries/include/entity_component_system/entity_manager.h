@@ -2,20 +2,29 @@
 
 #include <any>
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <set>
+#include <span>
 #include <typeindex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "../tbb_templates.hpp"
+#include "deferred_queue.h"
 #include "entity.h"
 #include "entity_manager_util.h"
+#include "event_channel.h"
+#include "prefab.h"
+#include "soa_vector.h"
+#include "spatial_index.h"
+#include "value_index.h"
 #include "system_manager.h"
 
 #ifdef UNIT_TEST
@@ -23,17 +32,64 @@
 #endif
 
 namespace ecs {
+enum class Buffering { kDouble, kSingle };
+enum class RemovalPolicy { kSwapPop, kStableCompact };
+
+struct AccessCounts {
+  std::uint64_t reads{0};
+  std::uint64_t writes{0};
+};
+
+struct StoreStats {
+  std::type_index type{typeid(void)};
+  std::size_t count{0};
+  std::size_t capacity{0};
+  std::size_t bytes{0};
+  std::size_t dirty{0};
+  std::size_t updated{0};
+  std::size_t added{0};
+  std::size_t removed{0};
+  std::chrono::nanoseconds sync_time{0};
+  std::chrono::nanoseconds copy_time{0};
+  AccessCounts access;
+};
+
+struct SyncStats {
+  std::size_t stores{0};
+  std::size_t pending_adds{0};
+  std::size_t pending_removes{0};
+  std::size_t pending_tags{0};
+  std::size_t pending_sorts{0};
+  std::size_t sync_hooks{0};
+  std::size_t tag_slots{0};
+  std::chrono::nanoseconds sync_time{0};
+};
+
+struct HotColdPolicy {
+  std::uint32_t cold_after_frames{60};
+  std::uint32_t repartition_interval{30};
+};
+
 class EntityManager {
  public:
   template <typename T>
   using dsm = std::unordered_map<std::type_index, T>;
 
+  template <typename T>
+  using ComponentVector =
+      std::conditional_t<SoaComponent<T>, SoaVector<T>, std::vector<T>>;
+
+  template <typename T>
+  using Observer =
+      std::function<void(std::span<const Entity>, std::span<const T>)>;
+
 #ifdef UNIT_TEST
   EntityManager(EntityManagerMock* mock) : mock_(mock) {}
-  EntityManagerMock* mock_;
+  EntityManagerMock* mock_{nullptr};
 #endif
 
   EntityManager() {}
+  ~EntityManager() { copy_group_.wait(); }
 
   Entity CreateEntity() {
 #ifdef UNIT_TEST
@@ -46,70 +102,153 @@ class EntityManager {
 #ifdef UNIT_TEST
     if (mock_) return mock_->SyncSwap();
 #endif
+    auto sync_start = std::chrono::steady_clock::now();
+    copy_group_.wait();
 
-    if (data_store_updates_.size() < 20)
-      for (auto& f : data_store_updates_) f();
-    else
-      tbb_templates::parallel_for(
-          data_store_updates_, [this](size_t i) { data_store_updates_[i](); });
+    for (auto& slot : resources_)
+      if (slot.sync) slot.sync();
+    for (auto& [type, slot] : event_channels_) slot.sync();
+
+    update_cost_.parallel_for(data_store_updates_.size(),
+                              [this](size_t i) { data_store_updates_[i](); });
 
     while (!remove_component_.empty()) {
       (remove_component_.back())();
       remove_component_.pop_back();
     }
+    compaction_cost_.parallel_for(compactions_.size(),
+                                  [this](size_t i) { compactions_[i](); });
+    compactions_.clear();
 
-    for (auto& entry : add_component_cache_) entry();
+    add_component_cache_.Canonicalize();
+    add_component_cache_.ForEach([](auto& entry) { entry(); });
     add_component_cache_.clear();
 
-    for (auto& [rem, rem_func] : remove_component_cache_) {
-      remove_component_.emplace_back(rem);
-      rem_func();
-    }
+    remove_component_cache_.Canonicalize();
+    remove_component_cache_.ForEach([this](auto& entry) {
+      remove_component_.emplace_back(entry.first);
+      entry.second();
+    });
     remove_component_cache_.clear();
 
+    UpdateTags();
+
+    sort_component_cache_.Canonicalize();
+    sort_component_cache_.ForEach([](auto& entry) { entry(); });
+    sort_component_cache_.clear();
+
+    hook_cost_.parallel_for(sync_hooks_.size(),
+                            [this](size_t i) { sync_hooks_[i](); });
+
     write_buffer_id_ = write_buffer_id_ == 0 ? 1 : 0;
+
+    if (async_copy_back_)
+      for (auto& copy_back : copy_backs_) copy_back();
+    last_sync_time_ = std::chrono::steady_clock::now() - sync_start;
   }
 
   template <typename T>
-  T& AddComponent() {
+  StoreStats StoreStatistics() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<StoreStats>(mock_->StoreStatistics(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) return ds->Stats();
+    return {};
+  }
+
+  std::vector<StoreStats> StoreStatistics() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<std::vector<StoreStats>>(
+          mock_->StoreStatistics());
+#endif
+    std::vector<StoreStats> stats;
+    stats.reserve(store_ops_.size() + tag_stores_.size());
+    for (auto& [type, ops] : store_ops_)
+      if (ops.stats) stats.emplace_back(ops.stats());
+    for (auto& [type, mask] : tag_stores_) {
+      auto& tag_stats = stats.emplace_back();
+      tag_stats.type = type;
+      tag_stats.count = mask.Count();
+      tag_stats.capacity = mask.words.capacity() * 64;
+      tag_stats.bytes = mask.words.capacity() * sizeof(std::uint64_t);
+    }
+    return stats;
+  }
+
+  SyncStats SyncStatistics() const {
+#ifdef UNIT_TEST
+    if (mock_) return std::any_cast<SyncStats>(mock_->SyncStatistics());
+#endif
+    SyncStats stats;
+    stats.stores = data_stores_.size();
+    stats.pending_adds = add_component_cache_.size();
+    stats.pending_removes = remove_component_cache_.size();
+    stats.pending_tags = tag_cache_.size();
+    stats.pending_sorts = sort_component_cache_.size();
+    stats.sync_hooks = sync_hooks_.size();
+    stats.tag_slots = tagged_entities_.size();
+    stats.sync_time = last_sync_time_;
+    return stats;
+  }
+
+  void SetAsyncCopyBack(bool enabled) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SetAsyncCopyBack(enabled);
+#endif
+    copy_group_.wait();
+    async_copy_back_ = enabled;
+  }
+
+  template <typename T>
+  T& AddComponent(Buffering buffering = Buffering::kDouble) {
 #ifdef UNIT_TEST
     if (mock_) return std::any_cast<T&>(mock_->AddComponent(typeid(T)));
 #endif
     auto ptr = std::make_shared<T>();
-    add_component_cache_.push_back([this, ptr]() {
-      auto it = data_stores_.find(typeid(T));
-      if (it == std::end(data_stores_)) {
-        auto data_store = std::make_shared<DataStore<T>>();
-        data_stores_.emplace(typeid(T), std::any(data_store));
-
-        data_store->dirty_components.insert(data_store->components[0].size());
-        data_store->added_components.emplace_back(
-            data_store->components[0].size());
-        data_store->entities.emplace_back(0);
-        (*data_store->entities.back().loc_map_)[typeid(T)].emplace_back(0);
-        data_store->components[0].emplace_back(*ptr);
-        data_store->components[1].emplace_back(*ptr);
-        data_store_updates_.emplace_back([this]() { UpdateDatastore<T>(); });
-      } else {
-        auto data_store =
-            std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
-        data_store->dirty_components.insert(0);
-        data_store->added_components.emplace_back(0);
-        data_store->components[0][0] = *ptr;
-        data_store->components[1][0] = *ptr;
+    add_component_cache_.push_back([this, ptr, buffering]() {
+      auto id = ResourceId<T>();
+      if (resources_.size() <= id) resources_.resize(id + 1);
+
+      auto& slot = resources_[id];
+      if (!slot.resource) {
+        auto resource = std::make_shared<Resource<T>>();
+        slot.sync = [this, res = resource.get()]() {
+          if (res->values.size() == 2 && res->dirty.exchange(false))
+            res->values[write_buffer_id_ == 0 ? 1 : 0] =
+                res->values[write_buffer_id_];
+        };
+        slot.resource = std::move(resource);
       }
+
+      auto resource = static_cast<Resource<T>*>(slot.resource.get());
+      resource->values.resize(buffering == Buffering::kDouble ? 2 : 1);
+      for (auto& value : resource->values) value = *ptr;
+      resource->dirty = false;
     });
     return *ptr;
   }
 
+  template <typename T>
+  void RemoveComponent() {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->RemoveComponent(typeid(T));
+#endif
+    add_component_cache_.push_back([this]() {
+      if (auto id = ResourceId<T>(); id < resources_.size())
+        resources_[id] = ResourceSlot();
+    });
+  }
+
   template <typename T>
   const T* ComponentR() const {
 #ifdef UNIT_TEST
     if (mock_) return &std::any_cast<T&>(mock_->ComponentR(typeid(T)));
 #endif
-    if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_))
-      return &std::any_cast<std::shared_ptr<DataStore<T>>>(it->second)
-                  ->components[write_buffer_id_ == 0 ? 1 : 0][0];
+    if (auto res = FindResource<T>(); res)
+      return &res->values[res->values.size() == 2 && write_buffer_id_ == 0 ? 1
+                                                                         : 0];
     return nullptr;
   }
 
@@ -118,11 +257,11 @@ class EntityManager {
 #ifdef UNIT_TEST
     if (mock_) return &std::any_cast<T&>(mock_->ComponentW(typeid(T)));
 #endif
-    if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
-      auto data_store =
-          std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
-      data_store->dirty_components.insert(0);
-      return &data_store->components[write_buffer_id_][0];
+    if (auto res = FindResource<T>(); res) {
+      if (res->values.size() == 1) return &res->values[0];
+      if (!res->dirty.load(std::memory_order_relaxed))
+        res->dirty.store(true, std::memory_order_relaxed);
+      return &res->values[write_buffer_id_];
     }
     return nullptr;
   }
@@ -136,6 +275,7 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->RecordRead();
       return ConstComponents<T, Entity>(
           &ds->components[write_buffer_id_ == 0 ? 1 : 0], &ds->entities);
     }
@@ -151,6 +291,8 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->RecordWrite();
+      ds->FlushCopy();
       return Components<T, Entity>(&ds->components[write_buffer_id_],
                                    &ds->entities);
     }
@@ -166,6 +308,7 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->FlushCopy();
       return UpdatedComponents<const std::vector<T>*, Entity>(
           &ds->components[write_buffer_id_], &ds->entities,
           &ds->updated_components);
@@ -183,6 +326,7 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->FlushCopy();
       return UpdatedComponents<std::vector<T>*, Entity>(
           &ds->components[write_buffer_id_], &ds->entities,
           &ds->updated_components);
@@ -200,6 +344,7 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->FlushCopy();
       return UpdatedComponents<const std::vector<T>*, Entity>(
           &ds->components[write_buffer_id_], &ds->entities,
           &ds->added_components);
@@ -217,6 +362,7 @@ class EntityManager {
 #endif
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto ds = std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      ds->FlushCopy();
       return UpdatedComponents<std::vector<T>*, Entity>(
           &ds->components[write_buffer_id_], &ds->entities,
           &ds->added_components);
@@ -241,6 +387,103 @@ class EntityManager {
     return RemovedComponentsHolder<T, Entity>(nullptr, nullptr, nullptr);
   }
 
+  template <typename T>
+  SoaComponents<const SoaVector<T>, Entity> ColumnsR() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<SoaComponents<const SoaVector<T>, Entity>>(
+          mock_->ColumnsR(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) {
+      ds->RecordRead();
+      return SoaComponents<const SoaVector<T>, Entity>(
+          &ds->components[write_buffer_id_ == 0 ? 1 : 0], &ds->entities);
+    }
+    return SoaComponents<const SoaVector<T>, Entity>(nullptr, nullptr);
+  }
+
+  template <typename T>
+  SoaComponents<SoaVector<T>, Entity> ColumnsW() {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<SoaComponents<SoaVector<T>, Entity>>(
+          mock_->ColumnsW(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) {
+      ds->RecordWrite();
+      ds->FlushCopy();
+      return SoaComponents<SoaVector<T>, Entity>(
+          &ds->components[write_buffer_id_], &ds->entities,
+          &ds->dirty_columns);
+    }
+    return SoaComponents<SoaVector<T>, Entity>(nullptr, nullptr);
+  }
+
+  template <typename T>
+  ConstComponents<T, Entity> HotComponentsR() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<ConstComponents<T, Entity>>(
+          mock_->HotComponentsR(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) {
+      ds->RecordRead();
+      return ConstComponents<T, Entity>(
+          &ds->components[write_buffer_id_ == 0 ? 1 : 0], &ds->entities,
+          ds->HotCount());
+    }
+    return ConstComponents<T, Entity>(nullptr, nullptr);
+  }
+
+  template <typename T>
+  Components<T, Entity> HotComponentsW() {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<Components<T, Entity>>(
+          mock_->HotComponentsW(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) {
+      ds->RecordWrite();
+      ds->FlushCopy();
+      return Components<T, Entity>(&ds->components[write_buffer_id_],
+                                   &ds->entities, ds->HotCount());
+    }
+    return Components<T, Entity>(nullptr, nullptr);
+  }
+
+  template <typename T>
+  void SetHotColdPolicy(HotColdPolicy policy) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SetHotColdPolicy(typeid(T));
+#endif
+    add_component_cache_.push_back([this, policy]() {
+      auto ds = CreateStore<T>();
+      ds->hot_cold = policy;
+      ds->track_access = true;
+      ds->last_write.assign(ds->entities.size(), ds->frame);
+      ds->hot_count = ds->entities.size();
+    });
+  }
+
+  template <typename T>
+  void TrackAccess(bool enabled = true) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->TrackAccess(typeid(T), enabled);
+#endif
+    add_component_cache_.push_back(
+        [this, enabled]() { CreateStore<T>()->track_access = enabled; });
+  }
+
+  template <typename T>
+  AccessCounts AccessStats() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<AccessCounts>(mock_->AccessStats(typeid(T)));
+#endif
+    if (auto ds = Store<T>(); ds) return ds->last_access;
+    return {};
+  }
+
   template <typename T>
   EntityHolder<Entity> Entities() {
 #ifdef UNIT_TEST
@@ -259,24 +502,13 @@ class EntityManager {
 #ifdef UNIT_TEST
     if (mock_) return std::any_cast<T&>(mock_->AddComponent(typeid(T), entity));
 #endif
-    auto ptr = std::make_shared<T>();
-    add_component_cache_.push_back([this, ptr, entity]() {
-      auto it = data_stores_.find(typeid(T));
-      if (it == std::end(data_stores_)) {
-        auto data_store = std::make_shared<DataStore<T>>();
-        data_stores_.emplace(typeid(T), std::any(data_store));
-
-        (*entity.loc_map_)[typeid(T)].push_back(data_store->entities.size());
-        data_store->dirty_components.insert(data_store->components[0].size());
-        data_store->added_components.emplace_back(
-            data_store->components[0].size());
-        data_store->entities.emplace_back(entity);
-        data_store->components[0].emplace_back(*ptr);
-        data_store->components[1].emplace_back(*ptr);
-        data_store_updates_.emplace_back([this]() { UpdateDatastore<T>(); });
-      } else {
-        auto data_store =
-            std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+    if constexpr (std::is_empty_v<T>) {
+      tag_cache_.emplace_back(typeid(T), entity, true);
+      return Tag<T>();
+    } else {
+      auto ptr = std::make_shared<T>();
+      add_component_cache_.push_back([this, ptr, entity]() {
+        auto data_store = CreateStore<T>();
         (*entity.loc_map_)[typeid(T)].push_back(data_store->entities.size());
         data_store->dirty_components.insert(data_store->components[0].size());
         data_store->added_components.emplace_back(
@@ -284,9 +516,53 @@ class EntityManager {
         data_store->entities.emplace_back(entity);
         data_store->components[0].emplace_back(*ptr);
         data_store->components[1].emplace_back(*ptr);
-      }
-    });
-    return *ptr;
+      });
+      return *ptr;
+    }
+  }
+
+  template <typename T>
+  void AddComponents(const std::vector<Entity>& entities, T value) {
+    AddComponents<T>(std::make_shared<const std::vector<Entity>>(entities),
+                     std::move(value), {});
+  }
+
+  std::vector<Entity> MoveEntities(const std::vector<Entity>& entities,
+                                   EntityManager& target) {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<std::vector<Entity>>(
+          mock_->MoveEntities(entities.size()));
+#endif
+    copy_group_.wait();
+    target.copy_group_.wait();
+
+    std::vector<std::uint8_t> pending(entities.size(), 0);
+    for (auto& [type, ops] : store_ops_)
+      ops.pending_removals(entities, pending);
+
+    std::vector<Entity> moving, deferred;
+    for (size_t i = 0; i < entities.size(); ++i)
+      (pending[i] ? deferred : moving).emplace_back(entities[i]);
+
+    if (!moving.empty()) {
+      for (auto& [type, ops] : store_ops_) ops.migrate(moving, target);
+      MoveTags(moving, target);
+    }
+    return deferred;
+  }
+
+  std::vector<Entity> Instantiate(const Prefab& prefab, size_t count) {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<std::vector<Entity>>(mock_->Instantiate(count));
+#endif
+    auto entities = std::make_shared<std::vector<Entity>>();
+    entities->reserve(count);
+    for (size_t i = 0; i < count; ++i) entities->emplace_back(0);
+    for (auto& [type, entry] : prefab.components_)
+      entry.spawn(*this, entities, entry.component.get());
+    return *entities;
   }
 
   template <typename T>
@@ -294,79 +570,133 @@ class EntityManager {
 #ifdef UNIT_TEST
     if (mock_) return mock_->RemoveComponent(typeid(T), entity, sub_loc);
 #endif
-    remove_component_cache_.push_back(std::make_pair(
-        [this, entity, sub_loc]() {
-          auto ent_loc = entity.Loc<T>(sub_loc);
-          if (ent_loc == std::numeric_limits<std::uint64_t>::max()) return;
-
-          auto& loc_map = (*entity.loc_map_)[typeid(T)];
-          loc_map.erase(std::begin(loc_map) + sub_loc);
-
-          if (auto ds_it = data_stores_.find(typeid(T));
-              ds_it != std::end(data_stores_)) {
-            auto data_store =
-                std::any_cast<std::shared_ptr<DataStore<T>>>(ds_it->second);
-
-            std::swap(data_store->entities[ent_loc],
-                      data_store->entities.back());
-            std::swap(data_store->components[0][ent_loc],
-                      data_store->components[0].back());
-            std::swap(data_store->components[1][ent_loc],
-                      data_store->components[1].back());
-            data_store->entities.pop_back();
-            data_store->components[0].pop_back();
-            data_store->components[1].pop_back();
-            data_store->removed_components.clear();
-
-            if (!data_store->entities.empty())
-              for (auto& e :
-                   (*data_store->entities[ent_loc].loc_map_)[typeid(T)])
-                if (e == data_store->entities.size()) e = ent_loc;
-          }
-        },
-        [this, entity, sub_loc]() {
-          if (auto ds_it = data_stores_.find(typeid(T));
-              ds_it != std::end(data_stores_)) {
+    if constexpr (std::is_empty_v<T>) {
+      tag_cache_.emplace_back(typeid(T), entity, false);
+    } else {
+      remove_component_cache_.push_back(std::make_pair(
+          [this, entity, sub_loc]() {
             auto ent_loc = entity.Loc<T>(sub_loc);
             if (ent_loc == std::numeric_limits<std::uint64_t>::max()) return;
 
-            auto data_store =
-                std::any_cast<std::shared_ptr<DataStore<T>>>(ds_it->second);
-            data_store->removed_components.emplace_back(ent_loc);
-          }
-        }));
+            if (auto ds_it = data_stores_.find(typeid(T));
+                ds_it != std::end(data_stores_)) {
+              auto data_store =
+                  std::any_cast<std::shared_ptr<DataStore<T>>>(ds_it->second);
+              if (ent_loc >= data_store->entities.size() ||
+                  data_store->entities[ent_loc] != entity)
+                return;
+
+              auto& loc_map = (*entity.loc_map_)[typeid(T)];
+              loc_map.erase(std::begin(loc_map) + sub_loc);
+
+              data_store->removed_components.clear();
+              if (data_store->removal_policy == RemovalPolicy::kSwapPop) {
+                data_store->SwapPop(ent_loc);
+                return;
+              }
+              if (data_store->compact_removals.empty())
+                compactions_.emplace_back([this, data_store]() {
+                  data_store->Compact(data_store->entities.size() >=
+                                      MIN_PARALLEL_COMPACT_SIZE);
+                });
+              data_store->compact_removals.emplace_back(ent_loc);
+            }
+          },
+          [this, entity, sub_loc]() {
+            if (auto ds_it = data_stores_.find(typeid(T));
+                ds_it != std::end(data_stores_)) {
+              auto ent_loc = entity.Loc<T>(sub_loc);
+              if (ent_loc == std::numeric_limits<std::uint64_t>::max()) return;
+
+              auto data_store =
+                  std::any_cast<std::shared_ptr<DataStore<T>>>(ds_it->second);
+              data_store->removed_components.emplace_back(ent_loc);
+            }
+          }));
+    }
+  }
+
+  template <typename T>
+  void SetRemovalPolicy(RemovalPolicy policy) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SetRemovalPolicy(typeid(T));
+#endif
+    add_component_cache_.push_back(
+        [this, policy]() { CreateStore<T>()->removal_policy = policy; });
+  }
+
+  template <typename T, typename F>
+  void SortComponents(F key_fn) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SortComponents(typeid(T));
+#endif
+    sort_component_cache_.push_back([this, key_fn]() {
+      if (auto data_store = Store<T>(); data_store) {
+        const auto& comps = data_store->components[write_buffer_id_];
+        SortDatastore<T>(*data_store,
+                         [&](size_t i) { return key_fn(comps[i]); });
+      }
+    });
+  }
+
+  template <typename T, typename U>
+  void MatchOrder() {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->MatchOrder(typeid(T), typeid(U));
+#endif
+    sort_component_cache_.push_back([this]() {
+      if (auto data_store = Store<T>(); data_store) {
+        const auto& ents = data_store->entities;
+        SortDatastore<T>(*data_store,
+                         [&](size_t i) { return ents[i].template Loc<U>(); });
+      }
+    });
   }
 
   template <typename T>
   const T* ComponentR(const Entity& entity, std::uint64_t sub_loc = 0) {
+    static_assert(!SoaComponent<T>,
+                  "SoA components are accessed through ColumnsR/ColumnsW");
 #ifdef UNIT_TEST
     if (mock_)
       return &std::any_cast<T&>(mock_->ComponentR(typeid(T), entity, sub_loc));
 #endif
-    if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
+    if constexpr (std::is_empty_v<T>) {
+      return HasTag<T>(entity) ? &Tag<T>() : nullptr;
+    } else {
+      auto it = data_stores_.find(typeid(T));
+      if (it == std::end(data_stores_)) return nullptr;
       auto ent_loc = entity.Loc<T>(sub_loc);
       if (ent_loc == std::numeric_limits<std::uint64_t>::max()) return nullptr;
-      return &std::any_cast<std::shared_ptr<DataStore<T>>>(it->second)
-                  ->components[write_buffer_id_ == 0 ? 1 : 0][ent_loc];
+      auto data_store =
+          std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      data_store->RecordRead();
+      return &data_store->components[write_buffer_id_ == 0 ? 1 : 0][ent_loc];
     }
-    return nullptr;
   }
 
   template <typename T>
   T* ComponentW(const Entity& entity, std::uint64_t sub_loc = 0) {
+    static_assert(!SoaComponent<T>,
+                  "SoA components are accessed through ColumnsR/ColumnsW");
 #ifdef UNIT_TEST
     if (mock_)
       return &std::any_cast<T&>(mock_->ComponentW(typeid(T), entity, sub_loc));
 #endif
-    if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
+    if constexpr (std::is_empty_v<T>) {
+      return HasTag<T>(entity) ? &Tag<T>() : nullptr;
+    } else {
+      auto it = data_stores_.find(typeid(T));
+      if (it == std::end(data_stores_)) return nullptr;
       auto ent_loc = entity.Loc<T>(sub_loc);
       if (ent_loc == std::numeric_limits<std::uint64_t>::max()) return nullptr;
       auto data_store =
           std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      data_store->RecordWrite();
+      data_store->FlushCopy();
       data_store->dirty_components.insert(ent_loc);
       return &data_store->components[write_buffer_id_][ent_loc];
     }
-    return nullptr;
   }
 
   template <typename T>
@@ -402,41 +732,775 @@ class EntityManager {
       return std::any_cast<std::uint64_t>(
           mock_->ComponentCount(typeid(T), entity));
 #endif
+    if constexpr (std::is_empty_v<T>) return HasTag<T>(entity) ? 1 : 0;
     if (auto it = entity.loc_map_->find(typeid(T));
         it != std::end(*entity.loc_map_))
       return it->second.size();
     return std::uint64_t(0);
   }
 
+  template <typename T>
+  void AddSharedComponent(Entity& entity, T value) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->AddSharedComponent(typeid(T), entity);
+#endif
+    add_component_cache_.push_back(
+        [this, entity, value = std::move(value)]() mutable {
+          AttachShared<T>(entity, std::move(value));
+        });
+  }
+
+  template <typename T>
+  void RemoveSharedComponent(Entity& entity) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->RemoveSharedComponent(typeid(T), entity);
+#endif
+    add_component_cache_.push_back([this, entity]() {
+      if (auto store = FindSharedStore<T>(); store)
+        DetachShared<T>(*store, entity);
+    });
+  }
+
+  template <typename T>
+  const T* SharedComponentR(const Entity& entity) const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return &std::any_cast<T&>(mock_->SharedComponentR(typeid(T), entity));
+#endif
+    auto handle = entity.Loc<Shared<T>>();
+    if (handle == std::numeric_limits<std::uint64_t>::max()) return nullptr;
+    if (auto store = FindSharedStore<T>(); store)
+      return &*store->groups[handle].value;
+    return nullptr;
+  }
+
+  template <typename T>
+  SharedGroups<T, Entity> SharedComponentsR() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<SharedGroups<T, Entity>>(
+          mock_->SharedComponentsR(typeid(T)));
+#endif
+    if (auto store = FindSharedStore<T>(); store)
+      return SharedGroups<T, Entity>(&store->groups);
+    return SharedGroups<T, Entity>(nullptr);
+  }
+
+  template <typename T>
+  void AddSpatialIndex(
+      float cell_size,
+      std::function<std::array<float, 3>(const T&)> position_func) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->AddSpatialIndex(typeid(T));
+#endif
+    add_component_cache_.push_back([this, cell_size, position_func]() {
+      auto index = std::make_shared<SpatialHashGrid<Entity>>(cell_size);
+      spatial_indices_[typeid(T)] = index;
+      if (auto ds = Store<T>(); ds) {
+        const auto& comps = ds->components[write_buffer_id_];
+        for (size_t i = 0; i < ds->entities.size(); ++i)
+          index->Insert(ds->entities[i], position_func(comps[i]));
+      }
+      SetSyncHook(spatial_hooks_, typeid(T), [this, index, position_func]() {
+        UpdateSpatialIndex<T>(*index, position_func);
+      });
+    });
+  }
+
+  template <typename T>
+  const SpatialHashGrid<Entity>* SpatialIndexR() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return &std::any_cast<SpatialHashGrid<Entity>&>(
+          mock_->SpatialIndexR(typeid(T)));
+#endif
+    if (auto it = spatial_indices_.find(typeid(T));
+        it != std::end(spatial_indices_))
+      return it->second.get();
+    return nullptr;
+  }
+
+  template <typename T, typename F>
+  void AddValueIndex(F key_func, IndexKind kind = IndexKind::kUnique) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->AddValueIndex(typeid(T));
+#endif
+    using Key = std::decay_t<std::invoke_result_t<F, const T&>>;
+    add_component_cache_.push_back([this, key_func, kind]() {
+      auto index = std::make_shared<ValueIndex<Key, Entity>>(kind);
+      value_indices_[typeid(T)] = index;
+      value_index_removals_[typeid(T)] = [index](const Entity& entity) {
+        index->Remove(entity);
+      };
+      if (auto ds = Store<T>(); ds) {
+        const auto& comps = ds->components[write_buffer_id_];
+        for (size_t i = 0; i < ds->entities.size(); ++i)
+          index->Insert(ds->entities[i], key_func(comps[i]));
+      }
+      SetSyncHook(value_hooks_, typeid(T), [this, index, key_func]() {
+        UpdateValueIndex<T>(*index, key_func);
+      });
+    });
+  }
+
+  template <typename T, typename Key>
+  const ValueIndex<Key, Entity>* ValueIndexR() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return &std::any_cast<ValueIndex<Key, Entity>&>(
+          mock_->ValueIndexR(typeid(T)));
+#endif
+    if (auto it = value_indices_.find(typeid(T));
+        it != std::end(value_indices_))
+      if (auto index =
+              std::any_cast<std::shared_ptr<ValueIndex<Key, Entity>>>(
+                  &it->second);
+          index)
+        return index->get();
+    return nullptr;
+  }
+
+  template <typename T, typename Key>
+  const Entity* FindEntity(const Key& key) const {
+    auto index = ValueIndexR<T, Key>();
+    return index ? index->Find(key) : nullptr;
+  }
+
+  template <typename T, typename Key>
+  std::span<const Entity> FindEntities(const Key& key) const {
+    auto index = ValueIndexR<T, Key>();
+    return index ? index->FindAll(key) : std::span<const Entity>();
+  }
+
+  template <typename T>
+  void OnAdded(Observer<T> observer) {
+    AddObserver<T>(&Observers<T>::added, std::move(observer));
+  }
+
+  template <typename T>
+  void OnUpdated(Observer<T> observer) {
+    AddObserver<T>(&Observers<T>::updated, std::move(observer));
+  }
+
+  template <typename T>
+  void OnRemoved(Observer<T> observer) {
+    AddObserver<T>(&Observers<T>::removed, std::move(observer));
+  }
+
+  template <typename E, typename... Args>
+  void SendEvent(Args&&... args) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SendEvent(typeid(E));
+#endif
+    Channel<E>().Send(std::forward<Args>(args)...);
+  }
+
+  template <typename E>
+  EventRange<E> EventsR() const {
+#ifdef UNIT_TEST
+    if (mock_) return std::any_cast<EventRange<E>>(mock_->EventsR(typeid(E)));
+#endif
+    if (auto it = event_channels_.find(typeid(E));
+        it != std::end(event_channels_))
+      return static_cast<EventChannel<E>*>(it->second.resource.get())
+          ->Events();
+    return EventRange<E>(nullptr, 0);
+  }
+
+  template <typename T>
+  const TagMask& TagsR() const {
+#ifdef UNIT_TEST
+    if (mock_) return std::any_cast<TagMask&>(mock_->TagsR(typeid(T)));
+#endif
+    static const TagMask empty_mask;
+    if (auto it = tag_stores_.find(typeid(T)); it != std::end(tag_stores_))
+      return it->second;
+    return empty_mask;
+  }
+
+  template <typename T, typename... Ts>
+  TaggedEntities<Entity> TagFilter() {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<TaggedEntities<Entity>>(
+          mock_->TagFilter(typeid(T)));
+#endif
+    TagMask mask = TagsR<T>();
+    (mask.And(TagsR<Ts>()), ...);
+    return TaggedEntities<Entity>(std::move(mask), &tagged_entities_);
+  }
+
  private:
+  friend class Prefab;
+
+  void SetSyncHook(dsm<size_t>& hooks, std::type_index type,
+                   std::function<void(void)> hook) {
+    auto [it, inserted] = hooks.try_emplace(type, sync_hooks_.size());
+    if (inserted)
+      sync_hooks_.emplace_back(std::move(hook));
+    else
+      sync_hooks_[it->second] = std::move(hook);
+  }
+
+  template <typename T, typename F>
+  void UpdateSpatialIndex(SpatialHashGrid<Entity>& index, F& position_func) {
+    auto ds = Store<T>();
+    if (!ds) return;
+
+    const auto& comps = ds->components[write_buffer_id_];
+    const auto& ents = ds->entities;
+    for (auto ind : ds->updated_components)
+      if (ind < ents.size()) index.Insert(ents[ind], position_func(comps[ind]));
+    for (auto ind : ds->added_components)
+      if (ind < ents.size()) index.Insert(ents[ind], position_func(comps[ind]));
+    for (auto ind : ds->removed_components)
+      if (ind < ents.size()) index.Remove(ents[ind]);
+  }
+
+  template <typename T, typename Key, typename F>
+  void UpdateValueIndex(ValueIndex<Key, Entity>& index, F& key_func) {
+    index.ClearConflicts();
+    auto ds = Store<T>();
+    if (!ds) return;
+
+    const auto& comps = ds->components[write_buffer_id_];
+    const auto& ents = ds->entities;
+    for (auto ind : ds->updated_components)
+      if (ind < ents.size()) index.Insert(ents[ind], key_func(comps[ind]));
+    for (auto ind : ds->added_components)
+      if (ind < ents.size()) index.Insert(ents[ind], key_func(comps[ind]));
+    for (auto ind : ds->removed_components)
+      if (ind < ents.size()) index.Remove(ents[ind]);
+  }
+
+  template <typename T>
+  void AddComponents(const Prefab::Entities& entities, T value,
+                     std::function<void(size_t, T&)> override) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->AddComponents(typeid(T), entities->size());
+#endif
+    if constexpr (std::is_empty_v<T>) {
+      for (auto& entity : *entities)
+        tag_cache_.emplace_back(typeid(T), entity, true);
+    } else {
+      add_component_cache_.push_back([this, entities, value = std::move(value),
+                                      override = std::move(override)]() {
+        auto ds = CreateStore<T>();
+        auto start = ds->entities.size();
+        auto count = entities->size();
+
+        for (size_t i = 0; i < count; ++i)
+          (*(*entities)[i].loc_map_)[typeid(T)].push_back(start + i);
+        ds->entities.insert(std::end(ds->entities), std::begin(*entities),
+                            std::end(*entities));
+        for (auto& comps : ds->components) {
+          if constexpr (SoaComponent<T>)
+            comps.append(count, value);
+          else
+            comps.insert(std::end(comps), count, value);
+        }
+        for (size_t i = 0; i < count; ++i) {
+          ds->dirty_components.insert(start + i);
+          ds->added_components.emplace_back(start + i);
+        }
+
+        if (!override) return;
+        for (size_t i = 0; i < count; ++i) {
+          auto&& comp = ds->components[0][start + i];
+          if constexpr (SoaComponent<T>) {
+            T tmp = comp;
+            override(i, tmp);
+            comp = tmp;
+          } else {
+            override(i, comp);
+          }
+          ds->components[1][start + i] = ds->components[0][start + i];
+        }
+      });
+    }
+  }
+
+  template <typename T>
+  struct Observers {
+    std::vector<Observer<T>> added;
+    std::vector<Observer<T>> updated;
+    std::vector<Observer<T>> removed;
+    std::vector<Entity> entities;
+    std::vector<T> components;
+  };
+
+  template <typename T>
+  void AddObserver(std::vector<Observer<T>> Observers<T>::*list,
+                   Observer<T> observer) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->AddObserver(typeid(T));
+#endif
+    add_component_cache_.push_back(
+        [this, list, observer = std::move(observer)]() {
+          auto& slot = observers_[typeid(T)];
+          if (!slot.has_value()) {
+            auto observers = std::make_shared<Observers<T>>();
+            slot = observers;
+            sync_hooks_.emplace_back([this, ptr = observers.get()]() {
+              NotifyObservers<T>(*ptr);
+            });
+          }
+          auto& observers =
+              *std::any_cast<std::shared_ptr<Observers<T>>&>(slot);
+          (observers.*list).push_back(observer);
+        });
+  }
+
+  template <typename T>
+  void NotifyObservers(Observers<T>& observers) {
+    auto ds = Store<T>();
+    if (!ds) return;
+
+    const auto& comps = ds->components[write_buffer_id_];
+    auto notify = [&](auto& list, const std::vector<size_t>& indices) {
+      if (list.empty() || indices.empty()) return;
+      observers.entities.clear();
+      observers.components.clear();
+      for (auto ind : indices) {
+        if (ind >= ds->entities.size()) continue;
+        observers.entities.push_back(ds->entities[ind]);
+        observers.components.push_back(comps[ind]);
+      }
+      for (auto& observer : list)
+        observer(observers.entities, observers.components);
+    };
+    notify(observers.added, ds->added_components);
+    notify(observers.updated, ds->updated_components);
+    notify(observers.removed, ds->removed_components);
+  }
+
+  template <typename T>
+  struct Resource {
+    std::vector<T> values;
+    std::atomic<bool> dirty{false};
+  };
+
+  struct ResourceSlot {
+    std::shared_ptr<void> resource;
+    std::function<void(void)> sync;
+  };
+
+  template <typename E>
+  EventChannel<E>& Channel() {
+    auto it = event_channels_.find(typeid(E));
+    if (it == std::end(event_channels_)) {
+      auto channel = std::make_shared<EventChannel<E>>();
+      it = event_channels_
+               .emplace(typeid(E),
+                        ResourceSlot{channel, [ptr = channel.get()]() {
+                                       ptr->Swap();
+                                     }})
+               .first;
+    }
+    return *static_cast<EventChannel<E>*>(it->second.resource.get());
+  }
+
+  template <typename T>
+  static size_t ResourceId() {
+    static const size_t id = next_resource_id_++;
+    return id;
+  }
+
+  template <typename T>
+  Resource<T>* FindResource() const {
+    if (auto id = ResourceId<T>(); id < resources_.size())
+      return static_cast<Resource<T>*>(resources_[id].resource.get());
+    return nullptr;
+  }
+
+  template <typename T>
+  struct Shared {};
+
+  template <typename T>
+  struct SharedStore {
+    std::vector<SharedGroup<T, Entity>> groups;
+    std::vector<size_t> free_groups;
+    std::unordered_multimap<size_t, size_t> lookup;
+  };
+
+  template <typename T>
+  std::shared_ptr<SharedStore<T>> FindSharedStore() const {
+    if (auto it = shared_stores_.find(typeid(T));
+        it != std::end(shared_stores_))
+      return std::any_cast<std::shared_ptr<SharedStore<T>>>(it->second);
+    return nullptr;
+  }
+
+  template <typename T>
+  std::shared_ptr<SharedStore<T>> CreateSharedStore() {
+    if (auto store = FindSharedStore<T>(); store) return store;
+    auto store = std::make_shared<SharedStore<T>>();
+    shared_stores_.emplace(typeid(T), std::any(store));
+    store_ops_[typeid(Shared<T>)] = {
+        [](const std::vector<Entity>&, std::vector<std::uint8_t>&) {},
+        [this](const std::vector<Entity>& entities, EntityManager& target) {
+          MigrateShared<T>(entities, target);
+        },
+        nullptr};
+    return store;
+  }
+
+  template <typename T>
+  void AttachShared(const Entity& entity, T value) {
+    auto store = CreateSharedStore<T>();
+    DetachShared<T>(*store, entity);
+
+    auto hash = std::hash<T>{}(value);
+    auto handle = store->groups.size();
+    auto [begin, end] = store->lookup.equal_range(hash);
+    for (auto it = begin; it != end; ++it)
+      if (*store->groups[it->second].value == value) {
+        handle = it->second;
+        break;
+      }
+
+    if (handle == store->groups.size()) {
+      if (!store->free_groups.empty()) {
+        handle = store->free_groups.back();
+        store->free_groups.pop_back();
+      } else {
+        store->groups.emplace_back();
+      }
+      store->groups[handle].value.emplace(std::move(value));
+      store->groups[handle].hash = hash;
+      store->lookup.emplace(hash, handle);
+    }
+
+    auto& group = store->groups[handle];
+    (*entity.loc_map_)[typeid(Shared<T>)] = {handle, group.entities.size()};
+    group.entities.emplace_back(entity);
+  }
+
+  template <typename T>
+  void MigrateShared(const std::vector<Entity>& entities,
+                     EntityManager& target) {
+    auto store = FindSharedStore<T>();
+    for (auto& entity : entities) {
+      auto it = entity.loc_map_->find(typeid(Shared<T>));
+      if (it == std::end(*entity.loc_map_)) continue;
+      auto value = *store->groups[it->second[0]].value;
+      DetachShared<T>(*store, entity);
+      target.AttachShared<T>(entity, std::move(value));
+    }
+  }
+
+  template <typename T>
+  void DetachShared(SharedStore<T>& store, const Entity& entity) {
+    auto it = entity.loc_map_->find(typeid(Shared<T>));
+    if (it == std::end(*entity.loc_map_)) return;
+    auto handle = it->second[0];
+    auto ind = it->second[1];
+    entity.loc_map_->erase(it);
+
+    auto& group = store.groups[handle];
+    std::swap(group.entities[ind], group.entities.back());
+    group.entities.pop_back();
+    if (ind < group.entities.size())
+      (*group.entities[ind].loc_map_)[typeid(Shared<T>)][1] = ind;
+
+    if (group.entities.empty()) {
+      auto [begin, end] = store.lookup.equal_range(group.hash);
+      for (auto l_it = begin; l_it != end; ++l_it)
+        if (l_it->second == handle) {
+          store.lookup.erase(l_it);
+          break;
+        }
+      group.value.reset();
+      store.free_groups.emplace_back(handle);
+    }
+  }
+
+  struct TagIndex {};
+
+  template <typename T>
+  static T& Tag() {
+    static T tag;
+    return tag;
+  }
+
+  template <typename T>
+  bool HasTag(const Entity& entity) const {
+    auto ind = entity.Loc<TagIndex>();
+    if (ind == std::numeric_limits<std::uint64_t>::max()) return false;
+    if (auto it = tag_stores_.find(typeid(T)); it != std::end(tag_stores_))
+      return it->second.Test(ind);
+    return false;
+  }
+
+  void UpdateTags() {
+    std::vector<size_t> untagged;
+    tag_cache_.Canonicalize();
+    tag_cache_.ForEach([this, &untagged](auto& entry) {
+      auto& [type, entity, set] = entry;
+      if (set) {
+        tag_stores_[type].Set(TagSlot(entity));
+        return;
+      }
+      auto ind = entity.template Loc<TagIndex>();
+      if (ind == std::numeric_limits<std::uint64_t>::max()) return;
+      if (auto it = tag_stores_.find(type); it != std::end(tag_stores_)) {
+        it->second.Reset(ind);
+        untagged.emplace_back(ind);
+      }
+    });
+    tag_cache_.clear();
+
+    std::sort(std::begin(untagged), std::end(untagged));
+    untagged.erase(std::unique(std::begin(untagged), std::end(untagged)),
+                   std::end(untagged));
+    for (auto ind : untagged) {
+      if (std::any_of(std::begin(tag_stores_), std::end(tag_stores_),
+                      [ind](auto& entry) { return entry.second.Test(ind); }))
+        continue;
+      tagged_entities_[ind].loc_map_->erase(typeid(TagIndex));
+      ReleaseTagSlot(ind);
+    }
+  }
+
+  size_t TagSlot(const Entity& entity) {
+    auto& ind_loc = (*entity.loc_map_)[typeid(TagIndex)];
+    if (!ind_loc.empty()) return ind_loc[0];
+    if (free_tag_slots_.empty()) {
+      ind_loc.emplace_back(tagged_entities_.size());
+      tagged_entities_.emplace_back(entity);
+    } else {
+      ind_loc.emplace_back(free_tag_slots_.back());
+      free_tag_slots_.pop_back();
+      tagged_entities_[ind_loc[0]] = entity;
+    }
+    return ind_loc[0];
+  }
+
+  void ReleaseTagSlot(size_t ind) {
+    tagged_entities_[ind] = Entity();
+    free_tag_slots_.emplace_back(ind);
+  }
+
+  void MoveTags(const std::vector<Entity>& entities, EntityManager& target) {
+    for (auto& entity : entities) {
+      auto it = entity.loc_map_->find(typeid(TagIndex));
+      if (it == std::end(*entity.loc_map_)) continue;
+      auto ind = it->second[0];
+      entity.loc_map_->erase(it);
+      ReleaseTagSlot(ind);
+
+      for (auto& [type, mask] : tag_stores_) {
+        if (!mask.Test(ind)) continue;
+        mask.Reset(ind);
+        target.tag_stores_[type].Set(target.TagSlot(entity));
+      }
+    }
+  }
+
+  template <typename T>
+  class DataStore;
+
+  template <typename T>
+  std::shared_ptr<DataStore<T>> Store() const {
+    if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_))
+      return std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+    return nullptr;
+  }
+
+  template <typename T>
+  std::shared_ptr<DataStore<T>> CreateStore() {
+    if (auto ds = Store<T>(); ds) return ds;
+    auto ds = std::make_shared<DataStore<T>>();
+    data_stores_.emplace(typeid(T), std::any(ds));
+    data_store_updates_.emplace_back([this]() { UpdateDatastore<T>(); });
+    copy_backs_.emplace_back([this, ptr = ds.get()]() {
+      if (ptr->updated_components.empty() && !ptr->copy_columns) return;
+      ptr->copy_from = write_buffer_id_ == 0 ? 1 : 0;
+      ptr->copy_to = write_buffer_id_;
+      ptr->copy_state = DataStore<T>::kCopyPending;
+      copy_group_.run([ptr]() { ptr->FlushCopy(); });
+    });
+    store_ops_[typeid(T)] = {
+        [ptr = ds.get()](const std::vector<Entity>& entities,
+                         std::vector<std::uint8_t>& pending) {
+          ptr->PendingRemovals(entities, pending);
+        },
+        [this](const std::vector<Entity>& entities, EntityManager& target) {
+          MigrateStore<T>(entities, target);
+        },
+        [ptr = ds.get()]() { return ptr->Stats(); }};
+    return ds;
+  }
+
+  template <typename T>
+  void MigrateStore(const std::vector<Entity>& entities,
+                    EntityManager& target) {
+    auto ds = Store<T>();
+    std::vector<std::pair<Entity, size_t>> moved;
+    for (auto& entity : entities) {
+      auto it = entity.loc_map_->find(typeid(T));
+      if (it == std::end(*entity.loc_map_)) continue;
+      for (auto loc : it->second) moved.emplace_back(entity, loc);
+      entity.loc_map_->erase(it);
+    }
+    if (moved.empty()) return;
+    DetachMoved<T>(*ds, moved);
+
+    auto target_ds = target.CreateStore<T>();
+    auto read_id = write_buffer_id_ == 0 ? 1 : 0;
+    auto target_write_id = target.write_buffer_id_;
+    auto target_read_id = target_write_id == 0 ? 1 : 0;
+    for (auto& [entity, loc] : moved) {
+      auto target_loc = target_ds->entities.size();
+      (*entity.loc_map_)[typeid(T)].push_back(target_loc);
+      target_ds->dirty_components.insert(target_loc);
+      target_ds->migrated_components.emplace_back(target_loc);
+      target_ds->entities.emplace_back(entity);
+      if (target_ds->hot_cold) {
+        std::uint32_t age =
+            loc < ds->last_write.size() ? ds->frame - ds->last_write[loc] : 0;
+        target_ds->last_write.resize(target_loc, target_ds->frame);
+        target_ds->last_write.push_back(target_ds->frame - age);
+      }
+      target_ds->components[target_write_id].emplace_back(
+          T(ds->components[write_buffer_id_][loc]));
+      target_ds->components[target_read_id].emplace_back(
+          T(ds->components[read_id][loc]));
+    }
+
+    if (ds->removal_policy == RemovalPolicy::kStableCompact) {
+      for (auto& [entity, loc] : moved) ds->compact_removals.push_back(loc);
+      ds->Compact(ds->entities.size() >= MIN_PARALLEL_COMPACT_SIZE);
+      return;
+    }
+    std::vector<size_t> locs;
+    for (auto& [entity, loc] : moved) locs.emplace_back(loc);
+    std::sort(std::rbegin(locs), std::rend(locs));
+    for (auto loc : locs) ds->SwapPop(loc);
+  }
+
+  template <typename T>
+  void DetachMoved(const DataStore<T>& ds,
+                   const std::vector<std::pair<Entity, size_t>>& moved) {
+    if (auto it = spatial_indices_.find(typeid(T));
+        it != std::end(spatial_indices_))
+      for (auto& [entity, loc] : moved) it->second->Remove(entity);
+    if (auto it = value_index_removals_.find(typeid(T));
+        it != std::end(value_index_removals_))
+      for (auto& [entity, loc] : moved) it->second(entity);
+
+    auto it = observers_.find(typeid(T));
+    if (it == std::end(observers_)) return;
+    auto& observers =
+        *std::any_cast<std::shared_ptr<Observers<T>>&>(it->second);
+    if (observers.removed.empty()) return;
+    observers.entities.clear();
+    observers.components.clear();
+    const auto& comps = ds.components[write_buffer_id_];
+    for (auto& [entity, loc] : moved) {
+      observers.entities.push_back(entity);
+      observers.components.push_back(comps[loc]);
+    }
+    for (auto& observer : observers.removed)
+      observer(observers.entities, observers.components);
+  }
+
+  template <typename T, typename F>
+  void SortDatastore(DataStore<T>& data_store, F key_fn) {
+    using key_t = std::decay_t<decltype(key_fn(size_t(0)))>;
+    auto size = data_store.entities.size();
+    if (size < 2) return;
+
+    std::vector<std::pair<key_t, size_t>> keys(size);
+    auto fill_keys = [&](size_t i) { keys[i] = {key_fn(i), i}; };
+    if (size < MIN_PARALLEL_SORT_SIZE) {
+      for (size_t i = 0; i < size; ++i) fill_keys(i);
+      std::sort(std::begin(keys), std::end(keys));
+    } else {
+      tbb_templates::parallel_for(keys, fill_keys);
+      tbb_templates::parallel_sort(std::begin(keys), std::end(keys));
+    }
+
+    std::vector<size_t> order(size);
+    for (size_t i = 0; i < size; ++i) order[i] = keys[i].second;
+    data_store.Permute(order, size >= MIN_PARALLEL_SORT_SIZE);
+  }
+
   template <typename T>
   void UpdateDatastore() {
     if (auto it = data_stores_.find(typeid(T)); it != std::end(data_stores_)) {
       auto data_store =
           std::any_cast<std::shared_ptr<DataStore<T>>>(it->second);
+      auto start = std::chrono::steady_clock::now();
 
       std::vector<size_t> dirty_components;
       for (auto& ind : data_store->dirty_components)
         dirty_components.emplace_back(ind);
       data_store->dirty_components.clear();
 
-      auto sort_unique = [](auto& vec) {
-        std::sort(std::begin(vec), std::end(vec));
+      auto sort_unique = [this](auto& vec) {
+        if (vec.size() >= MIN_PARALLEL_SORT_SIZE)
+          tbb_templates::parallel_sort(std::begin(vec), std::end(vec));
+        else
+          std::sort(std::begin(vec), std::end(vec));
         vec.erase(std::unique(std::begin(vec), std::end(vec)), std::end(vec));
       };
       sort_unique(dirty_components);
 
-      auto read_buffer_id = write_buffer_id_ == 0 ? 1 : 0;
-      for (auto ind : dirty_components)
-        data_store->components[read_buffer_id][ind] =
-            data_store->components[write_buffer_id_][ind];
+      auto dirty_columns = data_store->dirty_columns.exchange(0);
+
+      data_store->last_access = {};
+      if (data_store->track_access) {
+        for (auto& counts : data_store->access) {
+          data_store->last_access.reads += counts.reads;
+          data_store->last_access.writes += counts.writes;
+          counts = {};
+        }
+      }
+
+      if (data_store->hot_cold) {
+        auto& last_write = data_store->last_write;
+        last_write.resize(data_store->entities.size(), data_store->frame);
+        if (dirty_columns)
+          std::fill(std::begin(last_write), std::end(last_write),
+                    data_store->frame);
+        for (auto ind : dirty_components)
+          if (ind < last_write.size()) last_write[ind] = data_store->frame;
+        if (++data_store->frame % data_store->hot_cold->repartition_interval ==
+            0)
+          sort_component_cache_.push_back([this, data_store]() {
+            data_store->PartitionHot(data_store->entities.size() >=
+                                     MIN_PARALLEL_SORT_SIZE);
+          });
+      }
+
+      auto& from = data_store->components[write_buffer_id_];
+      auto& to = data_store->components[write_buffer_id_ == 0 ? 1 : 0];
+      auto copy_dirty = [&](size_t begin, size_t end) {
+        for (auto i = begin; i != end; ++i)
+          to[dirty_components[i]] = from[dirty_components[i]];
+      };
+      if (!async_copy_back_) {
+        if (dirty_components.size() >= MIN_PARALLEL_COMPACT_SIZE)
+          tbb_templates::parallel_for_blocked(0, dirty_components.size(),
+                                              copy_dirty,
+                                              MIN_PARALLEL_GRAIN_SIZE);
+        else
+          copy_dirty(0, dirty_components.size());
+        if constexpr (SoaComponent<T>)
+          if (dirty_columns) to.assign_columns(from, dirty_columns);
+      }
+      data_store->copy_columns = dirty_columns;
       data_store->updated_components.swap(dirty_components);
       data_store->added_components.clear();
+      data_store->added_components.swap(data_store->migrated_components);
+      data_store->sync_time = std::chrono::steady_clock::now() - start;
     }
   }
 
   template <typename T>
   class DataStore {
+    static_assert(!std::is_empty_v<T>, "tag components live in TagMask");
    public:
     DataStore() {
       components[0].reserve(128);
@@ -447,29 +1511,361 @@ class EntityManager {
       added_components.reserve(128);
     }
 
-    std::vector<T> components[2];
+    void SwapPop(size_t loc) {
+      auto back = entities.size() - 1;
+      using std::swap;
+      swap(entities[loc], entities.back());
+      swap(components[0][loc], components[0].back());
+      swap(components[1][loc], components[1].back());
+      entities.pop_back();
+      components[0].pop_back();
+      components[1].pop_back();
+      if (!last_write.empty()) {
+        last_write.resize(back + 1, frame);
+        last_write[loc] = last_write[back];
+        last_write.pop_back();
+      }
+
+      if (loc < back)
+        for (auto& e : (*entities[loc].loc_map_)[typeid(T)])
+          if (e == back) e = loc;
+
+      auto move_index = [&](std::vector<size_t>& indices) {
+        if (auto it = std::lower_bound(indices.begin(), indices.end(), loc);
+            it != indices.end() && *it == loc)
+          indices.erase(it);
+        if (!indices.empty() && indices.back() == back) {
+          indices.pop_back();
+          if (loc < back)
+            indices.insert(
+                std::lower_bound(indices.begin(), indices.end(), loc), loc);
+        }
+      };
+      move_index(updated_components);
+      move_index(added_components);
+      move_index(migrated_components);
+    }
+
+    void Permute(const std::vector<size_t>& order, bool parallel) {
+      auto size = order.size();
+      std::vector<size_t> new_loc(size);
+      for (size_t i = 0; i < size; ++i) new_loc[order[i]] = i;
+
+      auto gather = [&](auto& vec) {
+        std::remove_reference_t<decltype(vec)> sorted(size);
+        auto move_entries = [&](size_t begin, size_t end) {
+          for (auto i = begin; i != end; ++i)
+            sorted[i] = std::move(vec[order[i]]);
+        };
+        if (parallel)
+          tbb_templates::parallel_for_blocked(0, size, move_entries,
+                                              MIN_PARALLEL_GRAIN_SIZE);
+        else
+          move_entries(0, size);
+        vec.swap(sorted);
+      };
+      gather(components[0]);
+      gather(components[1]);
+      gather(entities);
+      if (!last_write.empty()) {
+        last_write.resize(size, frame);
+        gather(last_write);
+      }
+
+      std::vector<size_t> shared_locs;
+      auto remap_entity = [&](size_t i) {
+        auto& locs = (*entities[i].loc_map_)[typeid(T)];
+        if (locs.size() == 1)
+          locs[0] = i;
+        else
+          shared_locs.emplace_back(i);
+      };
+      for (size_t i = 0; i < size; ++i) remap_entity(i);
+
+      std::unordered_set<const void*> remapped;
+      for (auto i : shared_locs)
+        if (remapped.insert(entities[i].loc_map_.get()).second)
+          for (auto& loc : (*entities[i].loc_map_)[typeid(T)])
+            if (loc < size) loc = new_loc[loc];
+
+      auto remap_indices = [&](std::vector<size_t>& indices) {
+        for (auto& ind : indices)
+          if (ind < size) ind = new_loc[ind];
+        std::sort(std::begin(indices), std::end(indices));
+      };
+      remap_indices(removed_components);
+      remap_indices(updated_components);
+      remap_indices(added_components);
+      remap_indices(migrated_components);
+
+      std::vector<size_t> dirty;
+      for (auto ind : dirty_components)
+        dirty.emplace_back(ind < size ? new_loc[ind] : ind);
+      dirty_components.clear();
+      for (auto ind : dirty) dirty_components.insert(ind);
+    }
+
+    void Compact(bool parallel) {
+      auto& removals = compact_removals;
+      if (removals.empty()) return;
+      std::sort(std::begin(removals), std::end(removals));
+      removals.erase(std::unique(std::begin(removals), std::end(removals)),
+                     std::end(removals));
+
+      auto size = entities.size();
+      auto first = removals.front();
+      constexpr auto removed = std::numeric_limits<size_t>::max();
+      std::vector<size_t> new_loc(size);
+      std::iota(std::begin(new_loc), std::begin(new_loc) + first, size_t(0));
+      for (size_t i = first, r = 0, next = first; i < size; ++i) {
+        if (r < removals.size() && removals[r] == i) {
+          new_loc[i] = removed;
+          ++r;
+        } else {
+          new_loc[i] = next++;
+        }
+      }
+      auto kept = size - removals.size();
+
+      auto compact = [&](auto& vec) {
+        for (size_t i = first + 1; i < size; ++i)
+          if (new_loc[i] != removed) vec[new_loc[i]] = std::move(vec[i]);
+        vec.resize(kept);
+      };
+      if (parallel) {
+        tbb_templates::parallel_invoke([&]() { compact(components[0]); },
+                                       [&]() { compact(components[1]); },
+                                       [&]() { compact(entities); });
+      } else {
+        compact(components[0]);
+        compact(components[1]);
+        compact(entities);
+      }
+      if (!last_write.empty()) {
+        last_write.resize(size, frame);
+        compact(last_write);
+      }
+
+      auto remap_entity = [&](size_t i) {
+        auto& locs = entities[i].loc_map_->find(typeid(T))->second;
+        if (locs.size() == 1) locs[0] = i;
+      };
+      if (parallel)
+        tbb_templates::parallel_for(first, kept, remap_entity);
+      else
+        for (size_t i = first; i < kept; ++i) remap_entity(i);
+
+      std::vector<size_t> shared_locs;
+      for (size_t i = first; i < kept; ++i)
+        if (entities[i].loc_map_->find(typeid(T))->second.size() != 1)
+          shared_locs.emplace_back(i);
+
+      std::unordered_set<const void*> remapped;
+      for (auto i : shared_locs)
+        if (remapped.insert(entities[i].loc_map_.get()).second)
+          for (auto& loc : entities[i].loc_map_->find(typeid(T))->second)
+            if (loc < size) loc = new_loc[loc];
+
+      auto remap_indices = [&](std::vector<size_t>& indices) {
+        size_t out = 0;
+        for (auto ind : indices)
+          if (ind < size && new_loc[ind] != removed)
+            indices[out++] = new_loc[ind];
+        indices.resize(out);
+      };
+      remap_indices(removed_components);
+      remap_indices(updated_components);
+      remap_indices(added_components);
+      remap_indices(migrated_components);
+
+      std::vector<size_t> dirty;
+      for (auto ind : dirty_components)
+        if (ind < size && new_loc[ind] != removed)
+          dirty.emplace_back(new_loc[ind]);
+      dirty_components.clear();
+      for (auto ind : dirty) dirty_components.insert(ind);
+
+      removals.clear();
+    }
+
+    void PartitionHot(bool parallel) {
+      auto size = entities.size();
+      last_write.resize(size, frame);
+
+      std::vector<size_t> order(size);
+      std::iota(std::begin(order), std::end(order), size_t(0));
+      auto cold = std::stable_partition(
+          std::begin(order), std::end(order), [&](size_t i) {
+            return frame - last_write[i] <= hot_cold->cold_after_frames;
+          });
+      hot_count = cold - std::begin(order);
+      if (!std::is_sorted(std::begin(order), std::end(order)))
+        Permute(order, parallel);
+    }
+
+    size_t HotCount() const {
+      return hot_cold ? std::min(hot_count, entities.size()) : entities.size();
+    }
+
+    void PendingRemovals(const std::vector<Entity>& entities,
+                         std::vector<std::uint8_t>& pending) const {
+      if (removed_components.empty()) return;
+      std::vector<size_t> removed(removed_components);
+      std::sort(std::begin(removed), std::end(removed));
+      for (size_t i = 0; i < entities.size(); ++i) {
+        if (pending[i]) continue;
+        auto it = entities[i].loc_map_->find(typeid(T));
+        if (it == std::end(*entities[i].loc_map_)) continue;
+        for (auto loc : it->second)
+          if (std::binary_search(std::begin(removed), std::end(removed), loc))
+            pending[i] = 1;
+      }
+    }
+
+    void FlushCopy() {
+      auto state = copy_state.load(std::memory_order_acquire);
+      if (state == kCopyIdle) return;
+      if (state == kCopyPending &&
+          copy_state.compare_exchange_strong(state, kCopyRunning)) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto ind : updated_components)
+          components[copy_to][ind] = components[copy_from][ind];
+        if constexpr (SoaComponent<T>)
+          if (copy_columns)
+            components[copy_to].assign_columns(components[copy_from],
+                                               copy_columns);
+        copy_time = std::chrono::steady_clock::now() - start;
+        copy_state.store(kCopyIdle, std::memory_order_release);
+        copy_state.notify_all();
+        return;
+      }
+      while ((state = copy_state.load(std::memory_order_acquire)) !=
+             kCopyIdle)
+        copy_state.wait(state, std::memory_order_acquire);
+    }
+
+    StoreStats Stats() {
+      FlushCopy();
+
+      auto buffer_bytes = [](const ComponentVector<T>& comps) {
+        if constexpr (SoaComponent<T>)
+          return comps.capacity_bytes();
+        else
+          return comps.capacity() * sizeof(T);
+      };
+
+      StoreStats stats;
+      stats.type = typeid(T);
+      stats.count = entities.size();
+      stats.capacity = entities.capacity();
+      stats.bytes = buffer_bytes(components[0]) + buffer_bytes(components[1]) +
+                    entities.capacity() * sizeof(Entity);
+      stats.dirty = dirty_components.size();
+      stats.updated = updated_components.size();
+      stats.added = added_components.size();
+      stats.removed = removed_components.size();
+      stats.sync_time = sync_time;
+      stats.copy_time = copy_time;
+      stats.access = last_access;
+      return stats;
+    }
+
+    void RecordRead() const {
+      if (track_access) ++access.local().reads;
+    }
+    void RecordWrite() const {
+      if (track_access) ++access.local().writes;
+    }
+
+    ComponentVector<T> components[2];
     std::vector<Entity> entities;
 
+    std::optional<HotColdPolicy> hot_cold;
+    std::vector<std::uint32_t> last_write;
+    std::uint32_t frame{0};
+    size_t hot_count{0};
+
+    static constexpr std::uint8_t kCopyIdle{0};
+    static constexpr std::uint8_t kCopyPending{1};
+    static constexpr std::uint8_t kCopyRunning{2};
+    std::atomic<std::uint8_t> copy_state{kCopyIdle};
+    std::uint8_t copy_from{0};
+    std::uint8_t copy_to{1};
+    std::uint64_t copy_columns{0};
+
+    std::chrono::nanoseconds sync_time{0};
+    std::chrono::nanoseconds copy_time{0};
+
+    bool track_access{false};
+    mutable tbb::enumerable_thread_specific<AccessCounts> access;
+    AccessCounts last_access;
+
+    RemovalPolicy removal_policy{RemovalPolicy::kSwapPop};
+    std::vector<size_t> compact_removals;
+
+    std::atomic<std::uint64_t> dirty_columns{0};
     tbb::concurrent_unordered_set<size_t> dirty_components;
     std::vector<size_t> removed_components;
     std::vector<size_t> updated_components;
     std::vector<size_t> added_components;
+    std::vector<size_t> migrated_components;
   };
 
   std::uint8_t write_buffer_id_{0};
 
+  struct StoreOps {
+    std::function<void(const std::vector<Entity>&,
+                       std::vector<std::uint8_t>&)>
+        pending_removals;
+    std::function<void(const std::vector<Entity>&, EntityManager&)> migrate;
+    std::function<StoreStats(void)> stats;
+  };
+
   dsm<std::any> data_stores_;
   std::vector<std::function<void(void)>> data_store_updates_;
+  dsm<StoreOps> store_ops_;
 
-  tbb::concurrent_vector<std::function<void(void)>> add_component_cache_;
+  bool async_copy_back_{false};
+  std::chrono::nanoseconds last_sync_time_{0};
+  tbb_templates::CostModel update_cost_;
+  tbb_templates::CostModel compaction_cost_;
+  tbb_templates::CostModel hook_cost_;
+  std::vector<std::function<void(void)>> copy_backs_;
+  tbb::task_group copy_group_;
 
-  tbb::concurrent_vector<
+  DeferredQueue<std::function<void(void)>> add_component_cache_;
+
+  DeferredQueue<
       std::pair<std::function<void(void)>, std::function<void(void)>>>
       remove_component_cache_;
   std::vector<std::function<void(void)>> remove_component_;
+  std::vector<std::function<void(void)>> compactions_;
+  DeferredQueue<std::function<void(void)>> sort_component_cache_;
+
+  std::vector<std::function<void(void)>> sync_hooks_;
+  dsm<std::shared_ptr<SpatialHashGrid<Entity>>> spatial_indices_;
+  dsm<size_t> spatial_hooks_;
+  dsm<std::any> value_indices_;
+  dsm<size_t> value_hooks_;
+  dsm<std::function<void(const Entity&)>> value_index_removals_;
+  dsm<std::any> observers_;
+
+  static inline std::atomic<size_t> next_resource_id_{0};
+  std::vector<ResourceSlot> resources_;
+  tbb::concurrent_unordered_map<std::type_index, ResourceSlot> event_channels_;
+
+  dsm<std::any> shared_stores_;
+
+  dsm<TagMask> tag_stores_;
+  std::vector<Entity> tagged_entities_;
+  std::vector<size_t> free_tag_slots_;
+  DeferredQueue<std::tuple<std::type_index, Entity, bool>> tag_cache_;
 
   const std::uint16_t MAX_ADD_PER_CYCLE{1024};
   const std::uint16_t MAX_REMOVE_PER_CYCLE{1024};
+  const std::size_t MIN_PARALLEL_SORT_SIZE{8192};
+  const std::size_t MIN_PARALLEL_COMPACT_SIZE{8192};
+  static constexpr std::size_t MIN_PARALLEL_GRAIN_SIZE{1024};
 };
 
 using Entity_t = Entity;
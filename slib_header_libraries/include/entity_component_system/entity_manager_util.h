@@ -1,5 +1,8 @@
 #pragma once
 
+#include <bit>
+#include <limits>
+
 namespace ecs {
 template <typename T>
 using dsm = std::unordered_map<std::type_index, T>;
@@ -160,8 +163,9 @@ class EntityHolder {
 template <typename T, typename Ent>
 class Components {
  public:
-  Components(std::vector<T>* comps, std::vector<Ent>* ents)
-      : components(comps), entities(ents) {}
+  Components(std::vector<T>* comps, std::vector<Ent>* ents,
+             size_t limit = std::numeric_limits<size_t>::max())
+      : components(comps), entities(ents), limit(limit) {}
   Components& operator=(const Components& copy) = delete;
 
   template <typename T1, typename T2>
@@ -193,22 +197,17 @@ class Components {
 
   auto end() {
     if (components)
-      return iterator(components->data() + components->size(),
-                      entities->data() + entities->size());
+      return iterator(components->data() + size(), entities->data() + size());
     return iterator<T, Ent>(nullptr, nullptr);
   }
 
   auto size() {
     if (components && entities)
-      return std::min(components->size(), entities->size());
+      return std::min({components->size(), entities->size(), limit});
     return std::size_t(0);
   }
 
-  auto empty() {
-    if (components && entities)
-      return std::min(components->size(), entities->size()) == 0;
-    return true;
-  }
+  auto empty() { return size() == 0; }
 
   auto operator[](size_t i) {
     return std::make_tuple(std::ref((*components)[i]),
@@ -217,13 +216,15 @@ class Components {
 
   std::vector<T>* components{nullptr};
   std::vector<Ent>* entities{nullptr};
+  size_t limit;
 };
 
 template <typename T, typename Ent>
 class ConstComponents {
  public:
-  ConstComponents(const std::vector<T>* comps, std::vector<Ent>* ents)
-      : components(comps), entities(ents) {}
+  ConstComponents(const std::vector<T>* comps, std::vector<Ent>* ents,
+                  size_t limit = std::numeric_limits<size_t>::max())
+      : components(comps), entities(ents), limit(limit) {}
   ConstComponents& operator=(const ConstComponents& copy) = delete;
 
   template <typename T1, typename T2>
@@ -255,22 +256,17 @@ class ConstComponents {
 
   auto end() {
     if (components)
-      return iterator(components->data() + components->size(),
-                      entities->data() + entities->size());
+      return iterator(components->data() + size(), entities->data() + size());
     return iterator<const T, Ent>(nullptr, nullptr);
   }
 
   auto size() {
     if (components && entities)
-      return std::min(components->size(), entities->size());
+      return std::min({components->size(), entities->size(), limit});
     return std::size_t(0);
   }
 
-  auto empty() {
-    if (components && entities)
-      return std::min(components->size(), entities->size()) == 0;
-    return true;
-  }
+  auto empty() { return size() == 0; }
 
   auto operator[](size_t i) {
     return std::make_tuple(std::ref((*components)[i]),
@@ -279,6 +275,7 @@ class ConstComponents {
 
   const std::vector<T>* components{nullptr};
   std::vector<Ent>* entities{nullptr};
+  size_t limit;
 };
 
 template <typename T, typename Ent>
@@ -347,6 +344,204 @@ class UpdatedComponents {
   std::vector<Ent>* entities;
   std::vector<size_t>* indices;
 };
+
+template <typename T, typename Ent>
+struct SharedGroup {
+  std::optional<T> value;
+  size_t hash{0};
+  std::vector<Ent> entities;
+};
+
+template <typename T, typename Ent>
+class SharedGroups {
+ public:
+  SharedGroups(std::vector<SharedGroup<T, Ent>>* groups) : groups(groups) {}
+  SharedGroups& operator=(const SharedGroups& copy) = delete;
+
+  class iterator {
+   public:
+    iterator(SharedGroup<T, Ent>* group, SharedGroup<T, Ent>* end)
+        : group(group), end(end) {
+      Skip();
+    }
+
+    auto operator++() {
+      ++group;
+      Skip();
+      return *this;
+    }
+    bool operator!=(const iterator& other) { return other.group != group; }
+    auto operator*() {
+      return std::make_tuple(std::cref(*group->value),
+                             EntityHolder<Ent>(&group->entities));
+    }
+
+   private:
+    void Skip() {
+      while (group != end && group->entities.empty()) ++group;
+    }
+
+    SharedGroup<T, Ent>* group;
+    SharedGroup<T, Ent>* end;
+  };
+
+  auto begin() {
+    if (groups)
+      return iterator(groups->data(), groups->data() + groups->size());
+    return iterator(nullptr, nullptr);
+  }
+
+  auto end() {
+    if (groups) {
+      auto end = groups->data() + groups->size();
+      return iterator(end, end);
+    }
+    return iterator(nullptr, nullptr);
+  }
+
+  auto size() {
+    size_t count{0};
+    if (groups)
+      for (auto& group : *groups) count += !group.entities.empty();
+    return count;
+  }
+
+  auto empty() { return size() == 0; }
+
+  std::vector<SharedGroup<T, Ent>>* groups;
+};
+
+class TagMask {
+ public:
+  void Set(size_t i) {
+    if (i / 64 >= words.size()) words.resize(i / 64 + 1, 0);
+    words[i / 64] |= std::uint64_t(1) << (i % 64);
+  }
+
+  void Reset(size_t i) {
+    if (i / 64 < words.size())
+      words[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+  }
+
+  bool Test(size_t i) const {
+    return i / 64 < words.size() &&
+           (words[i / 64] >> (i % 64)) & std::uint64_t(1);
+  }
+
+  TagMask& And(const TagMask& other) {
+    if (words.size() > other.words.size()) words.resize(other.words.size());
+    for (size_t i = 0; i < words.size(); ++i) words[i] &= other.words[i];
+    return *this;
+  }
+
+  TagMask& AndNot(const TagMask& other) {
+    auto size = std::min(words.size(), other.words.size());
+    for (size_t i = 0; i < size; ++i) words[i] &= ~other.words[i];
+    return *this;
+  }
+
+  TagMask& Or(const TagMask& other) {
+    if (words.size() < other.words.size()) words.resize(other.words.size(), 0);
+    for (size_t i = 0; i < other.words.size(); ++i) words[i] |= other.words[i];
+    return *this;
+  }
+
+  size_t Count() const {
+    size_t count{0};
+    for (auto word : words) count += std::popcount(word);
+    return count;
+  }
+
+  class iterator {
+   public:
+    iterator(const std::uint64_t* begin, const std::uint64_t* word,
+             const std::uint64_t* end)
+        : begin_(begin),
+          word_(word),
+          end_(end),
+          bits_(word != end ? *word : 0) {
+      Advance();
+    }
+
+    auto operator++() {
+      bits_ &= bits_ - 1;
+      Advance();
+      return *this;
+    }
+    bool operator!=(const iterator& other) {
+      return other.word_ != word_ || other.bits_ != bits_;
+    }
+    size_t operator*() {
+      return size_t(word_ - begin_) * 64 + std::countr_zero(bits_);
+    }
+
+   private:
+    void Advance() {
+      while (!bits_ && word_ != end_)
+        if (++word_ != end_) bits_ = *word_;
+    }
+
+    const std::uint64_t* begin_;
+    const std::uint64_t* word_;
+    const std::uint64_t* end_;
+    std::uint64_t bits_;
+  };
+
+  auto begin() const {
+    return iterator(words.data(), words.data(), words.data() + words.size());
+  }
+
+  auto end() const {
+    auto end = words.data() + words.size();
+    return iterator(words.data(), end, end);
+  }
+
+  std::vector<std::uint64_t> words;
+};
+
+template <typename Ent>
+class TaggedEntities {
+ public:
+  TaggedEntities(TagMask mask, std::vector<Ent>* ents)
+      : mask(std::move(mask)), entities(ents) {}
+  TaggedEntities& operator=(const TaggedEntities& copy) = delete;
+
+  TaggedEntities With(const TagMask& other) {
+    mask.And(other);
+    return *this;
+  }
+
+  TaggedEntities Without(const TagMask& other) {
+    mask.AndNot(other);
+    return *this;
+  }
+
+  class iterator {
+   public:
+    iterator(TagMask::iterator it, std::vector<Ent>* ents)
+        : it_(it), entities(ents) {}
+
+    auto operator++() {
+      ++it_;
+      return *this;
+    }
+    bool operator!=(const iterator& other) { return it_ != other.it_; }
+    auto& operator*() { return (*entities)[*it_]; }
+
+   private:
+    TagMask::iterator it_;
+    std::vector<Ent>* entities;
+  };
+
+  auto begin() { return iterator(mask.begin(), entities); }
+  auto end() { return iterator(mask.end(), entities); }
+
+  auto size() { return mask.Count(); }
+  auto empty() { return size() == 0; }
+
+  TagMask mask;
+  std::vector<Ent>* entities;
+};
 }  // namespace ecs
 
 namespace ecss {
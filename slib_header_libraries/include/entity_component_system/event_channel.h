@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "../tbb_templates.hpp"
+
+namespace ecs {
+template <typename E>
+class EventRange {
+ public:
+  EventRange(const std::vector<const std::vector<E>*>* segs, size_t size)
+      : segments(segs), count(size) {}
+
+  class iterator {
+   public:
+    iterator(const std::vector<const std::vector<E>*>* segs, size_t seg)
+        : segments(segs), seg(seg), ind(0) {}
+
+    auto operator++() {
+      if (++ind == (*segments)[seg]->size()) {
+        ++seg;
+        ind = 0;
+      }
+      return *this;
+    }
+    bool operator!=(const iterator& other) {
+      return other.seg != seg || other.ind != ind;
+    }
+    const E& operator*() { return (*(*segments)[seg])[ind]; }
+
+   private:
+    const std::vector<const std::vector<E>*>* segments;
+    size_t seg;
+    size_t ind;
+  };
+
+  auto begin() const { return iterator(segments, 0); }
+  auto end() const {
+    return iterator(segments, segments ? segments->size() : 0);
+  }
+
+  template <typename F>
+  void ForEachSegment(F&& func) const {
+    if (segments)
+      for (auto seg : *segments) func(seg->data(), seg->size());
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+ private:
+  const std::vector<const std::vector<E>*>* segments;
+  size_t count;
+};
+
+template <typename E>
+class EventChannel {
+ public:
+  template <typename... Args>
+  void Send(Args&&... args) {
+    segments_[write_id_.load(std::memory_order_relaxed)]
+        .local()
+        .emplace_back(std::forward<Args>(args)...);
+  }
+
+  void Swap() {
+    auto read_id = write_id_.load(std::memory_order_relaxed);
+    auto write_id = read_id == 0 ? 1 : 0;
+    for (auto& seg : segments_[write_id]) seg.clear();
+    write_id_.store(write_id, std::memory_order_relaxed);
+
+    read_segments_.clear();
+    read_count_ = 0;
+    for (auto& seg : segments_[read_id]) {
+      if (seg.empty()) continue;
+      read_segments_.push_back(&seg);
+      read_count_ += seg.size();
+    }
+  }
+
+  EventRange<E> Events() const {
+    return EventRange<E>(&read_segments_, read_count_);
+  }
+
+ private:
+  tbb::enumerable_thread_specific<std::vector<E>> segments_[2];
+  std::atomic<std::uint8_t> write_id_{0};
+  std::vector<const std::vector<E>*> read_segments_;
+  size_t read_count_{0};
+};
+}  // namespace ecs
@@ -22,8 +22,22 @@ class EntityManagerMock {
   MOCK_METHOD(std::any&, ComponentsW, (std::type_index));
   MOCK_METHOD(std::any&, ComponentsR, (std::type_index, const Entity&));
   MOCK_METHOD(std::any&, ComponentsW, (std::type_index, const Entity&));
+  MOCK_METHOD(std::any&, ColumnsR, (std::type_index));
+  MOCK_METHOD(std::any&, ColumnsW, (std::type_index));
   MOCK_METHOD(void, RemoveComponent, (std::type_index));
   MOCK_METHOD(void, RemoveComponent, (std::type_index, const Entity&, size_t));
+  MOCK_METHOD(void, SetAsyncCopyBack, (bool));
+  MOCK_METHOD(std::any&, StoreStatistics, (std::type_index));
+  MOCK_METHOD(std::any&, StoreStatistics, ());
+  MOCK_METHOD(std::any&, SyncStatistics, ());
+  MOCK_METHOD(void, SetRemovalPolicy, (std::type_index));
+  MOCK_METHOD(void, SetHotColdPolicy, (std::type_index));
+  MOCK_METHOD(void, TrackAccess, (std::type_index, bool));
+  MOCK_METHOD(std::any&, HotComponentsR, (std::type_index));
+  MOCK_METHOD(std::any&, HotComponentsW, (std::type_index));
+  MOCK_METHOD(std::any&, AccessStats, (std::type_index));
+  MOCK_METHOD(void, SortComponents, (std::type_index));
+  MOCK_METHOD(void, MatchOrder, (std::type_index, std::type_index));
 
   MOCK_METHOD(std::any&, AddedComponentsR, (std::type_index));
   MOCK_METHOD(std::any&, AddedComponentsW, (std::type_index));
@@ -33,6 +47,22 @@ class EntityManagerMock {
   MOCK_METHOD(std::any&, Entities, (std::type_index));
 
   MOCK_METHOD(std::any&, ComponentCount, (std::type_index, const Entity&));
+  MOCK_METHOD(void, AddSharedComponent, (std::type_index, const Entity&));
+  MOCK_METHOD(void, RemoveSharedComponent, (std::type_index, const Entity&));
+  MOCK_METHOD(std::any&, SharedComponentR, (std::type_index, const Entity&));
+  MOCK_METHOD(std::any&, SharedComponentsR, (std::type_index));
+  MOCK_METHOD(void, AddSpatialIndex, (std::type_index));
+  MOCK_METHOD(std::any&, SpatialIndexR, (std::type_index));
+  MOCK_METHOD(void, AddValueIndex, (std::type_index));
+  MOCK_METHOD(std::any&, ValueIndexR, (std::type_index));
+  MOCK_METHOD(void, AddComponents, (std::type_index, size_t));
+  MOCK_METHOD(std::any&, MoveEntities, (size_t));
+  MOCK_METHOD(std::any&, Instantiate, (size_t));
+  MOCK_METHOD(void, AddObserver, (std::type_index));
+  MOCK_METHOD(void, SendEvent, (std::type_index));
+  MOCK_METHOD(std::any&, EventsR, (std::type_index));
+  MOCK_METHOD(std::any&, TagsR, (std::type_index));
+  MOCK_METHOD(std::any&, TagFilter, (std::type_index));
 };
 }  // namespace ecs
 
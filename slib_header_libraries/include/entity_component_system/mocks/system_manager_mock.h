@@ -4,9 +4,17 @@ namespace ecs {
 class SystemManagerMock {
  public:
   MOCK_METHOD(void, Step, (class EntityManager&));
+  MOCK_METHOD(void, StepShards, ());
   MOCK_METHOD(void, SyncSystems, ());
   MOCK_METHOD(void, AddSystem, (const std::type_index));
   MOCK_METHOD(void, RemoveSystem, (const std::type_index));
   MOCK_METHOD(std::any&, System, (const std::type_index));
+  MOCK_METHOD(std::any&, ExecutionGroup, (const std::type_index));
+  MOCK_METHOD(void, SetFrameBudget, (std::chrono::nanoseconds, std::uint32_t));
+  MOCK_METHOD(bool, OverBudget, ());
+  MOCK_METHOD(std::chrono::nanoseconds, TimeLeft, ());
+  MOCK_METHOD(std::uint32_t, DeferredFrames, (const std::type_index));
+  MOCK_METHOD(std::any&, Launch, (std::uint32_t));
+  MOCK_METHOD(std::any&, DependencyCycles, ());
 };
 }  // namespace ecs
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+#include "entity.h"
+
+namespace ecs {
+class EntityManager;
+
+class Prefab {
+ public:
+  using Entities = std::shared_ptr<const std::vector<Entity>>;
+
+  template <typename T>
+  Prefab& Add(T value) {
+    auto component = std::make_shared<Component<T>>();
+    component->value = std::move(value);
+    auto spawn = &Prefab::Spawn<T, EntityManager>;
+
+    for (auto& [type, entry] : components_) {
+      if (type != typeid(T)) continue;
+      entry = {component, spawn};
+      return *this;
+    }
+    components_.emplace_back(typeid(T), Entry{component, spawn});
+    return *this;
+  }
+
+  template <typename T>
+  Prefab& Override(std::function<void(size_t, T&)> func) {
+    for (auto& [type, entry] : components_)
+      if (type == typeid(T))
+        static_cast<Component<T>*>(entry.component.get())->override =
+            std::move(func);
+    return *this;
+  }
+
+  size_t size() const { return components_.size(); }
+
+ private:
+  friend class EntityManager;
+
+  template <typename T>
+  struct Component {
+    T value;
+    std::function<void(size_t, T&)> override;
+  };
+
+  template <typename T, typename Mgr>
+  static void Spawn(Mgr& ent_mgr, const Entities& ents, const void* ptr) {
+    auto component = static_cast<const Component<T>*>(ptr);
+    ent_mgr.template AddComponents<T>(ents, component->value,
+                                      component->override);
+  }
+
+  struct Entry {
+    std::shared_ptr<void> component;
+    void (*spawn)(EntityManager&, const Entities&, const void*);
+  };
+
+  std::vector<std::pair<std::type_index, Entry>> components_;
+};
+}  // namespace ecs
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "../tbb_templates.hpp"
+#include "entity_manager.h"
+
+namespace ecs {
+class ShardedEntityManager {
+ public:
+  ShardedEntityManager() : ShardedEntityManager(tbb::info::numa_nodes()) {}
+
+  explicit ShardedEntityManager(
+      const std::vector<tbb::numa_node_id>& numa_nodes) {
+    for (auto numa_node : numa_nodes) {
+      auto& shard = shards_.emplace_back(std::make_unique<ShardSlot>());
+      shard->arena.initialize(tbb::task_arena::constraints(numa_node));
+      shard->arena.execute(
+          [&]() { shard->ent_mgr = std::make_unique<EntityManager>(); });
+    }
+  }
+
+  size_t ShardCount() const { return shards_.size(); }
+  EntityManager& Shard(size_t shard) { return *shards_[shard]->ent_mgr; }
+  tbb::task_arena& Arena(size_t shard) { return shards_[shard]->arena; }
+
+  Entity CreateEntity(size_t shard) {
+    return shards_[shard]->ent_mgr->CreateEntity();
+  }
+
+  template <typename F>
+  void Execute(size_t shard, F&& func) {
+    auto& ent_mgr = *shards_[shard]->ent_mgr;
+    shards_[shard]->arena.execute([&]() { func(ent_mgr); });
+  }
+
+  template <typename F>
+  void ForEachShard(F&& func) {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      auto& shard = *shards_[i];
+      shard.arena.execute([&, i]() {
+        shard.group.run([&, i]() { func(i, *shard.ent_mgr); });
+      });
+    }
+    for (auto& shard : shards_)
+      shard->arena.execute([&]() { shard->group.wait(); });
+  }
+
+  void Migrate(const Entity& entity, size_t from, size_t to) {
+    if (from != to) migrations_.emplace_back(entity, from, to);
+  }
+
+  void SyncSwap() {
+    ForEachShard([](size_t, EntityManager& ent_mgr) { ent_mgr.SyncSwap(); });
+    ApplyMigrations();
+  }
+
+ private:
+  struct ShardSlot {
+    tbb::task_arena arena;
+    tbb::task_group group;
+    std::unique_ptr<EntityManager> ent_mgr;
+  };
+
+  void ApplyMigrations() {
+    std::vector<std::tuple<Entity, size_t, size_t>> migrations(
+        std::begin(migrations_), std::end(migrations_));
+    migrations_.clear();
+    std::stable_sort(std::begin(migrations), std::end(migrations),
+                     [](auto& a, auto& b) {
+                       return std::tie(std::get<1>(a), std::get<2>(a)) <
+                              std::tie(std::get<1>(b), std::get<2>(b));
+                     });
+
+    std::vector<Entity> batch;
+    for (size_t i = 0; i < migrations.size();) {
+      auto from = std::get<1>(migrations[i]);
+      auto to = std::get<2>(migrations[i]);
+      batch.clear();
+      for (; i < migrations.size() && std::get<1>(migrations[i]) == from &&
+             std::get<2>(migrations[i]) == to;
+           ++i)
+        batch.emplace_back(std::get<0>(migrations[i]));
+
+      auto& source = *shards_[from]->ent_mgr;
+      auto& target = *shards_[to]->ent_mgr;
+      shards_[to]->arena.execute([&]() {
+        for (auto& entity : source.MoveEntities(batch, target))
+          migrations_.emplace_back(entity, from, to);
+      });
+    }
+  }
+
+  std::vector<std::unique_ptr<ShardSlot>> shards_;
+  tbb::concurrent_vector<std::tuple<Entity, size_t, size_t>> migrations_;
+};
+}  // namespace ecs
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+template <typename T>
+struct SoaLayout;
+
+template <typename T>
+concept SoaComponent = requires { SoaLayout<T>::fields; };
+
+template <typename T, std::size_t Align>
+class AlignedAllocator {
+ public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Align>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t{Align}));
+  }
+
+  void deallocate(T* ptr, std::size_t) {
+    ::operator delete(ptr, std::align_val_t{Align});
+  }
+
+  bool operator==(const AlignedAllocator&) const { return true; }
+  bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template <typename M>
+struct MemberType;
+
+template <typename C, typename F>
+struct MemberType<F C::*> {
+  using type = F;
+};
+
+template <typename T, std::size_t Align = 64>
+class SoaVector {
+ public:
+  static constexpr auto fields = SoaLayout<T>::fields;
+  static constexpr std::size_t field_count =
+      std::tuple_size_v<std::remove_const_t<decltype(fields)>>;
+
+  template <std::size_t I>
+  using field_t = typename MemberType<std::remove_const_t<
+      std::tuple_element_t<I, std::remove_const_t<decltype(fields)>>>>::type;
+
+  template <std::size_t I>
+  using column_t = std::vector<field_t<I>, AlignedAllocator<field_t<I>, Align>>;
+
+  static_assert(field_count <= 64, "SoaVector tracks at most 64 columns");
+  static constexpr std::uint64_t all_columns =
+      field_count == 64 ? ~std::uint64_t(0)
+                        : (std::uint64_t(1) << field_count) - 1;
+
+  template <typename V>
+  class Reference {
+   public:
+    Reference(V* vec, std::size_t ind) : vec_(vec), ind_(ind) {}
+    Reference(const Reference& copy) = default;
+
+    template <std::size_t I>
+    auto& get() const {
+      return vec_->template column<I>()[ind_];
+    }
+
+    operator T() const {
+      T out{};
+      ForEachField([&](auto i) { out.*std::get<i>(fields) = get<i>(); });
+      return out;
+    }
+
+    Reference& operator=(const T& value) {
+      ForEachField([&](auto i) { get<i>() = value.*std::get<i>(fields); });
+      return *this;
+    }
+
+    Reference& operator=(const Reference& other) {
+      ForEachField([&](auto i) { get<i>() = other.template get<i>(); });
+      return *this;
+    }
+
+    friend void swap(Reference a, Reference b) {
+      ForEachField([&](auto i) {
+        using std::swap;
+        swap(a.template get<i>(), b.template get<i>());
+      });
+    }
+
+   private:
+    V* vec_;
+    std::size_t ind_;
+  };
+
+  SoaVector() = default;
+  SoaVector(std::size_t size) { resize(size); }
+
+  template <std::size_t I>
+  field_t<I>* column() {
+    return std::get<I>(columns_).data();
+  }
+
+  template <std::size_t I>
+  const field_t<I>* column() const {
+    return std::get<I>(columns_).data();
+  }
+
+  std::size_t size() const { return std::get<0>(columns_).size(); }
+  std::size_t capacity() const { return std::get<0>(columns_).capacity(); }
+  bool empty() const { return size() == 0; }
+
+  std::size_t capacity_bytes() const {
+    std::size_t bytes{0};
+    ForEachField([&](auto i) {
+      bytes += std::get<i>(columns_).capacity() * sizeof(field_t<i>);
+    });
+    return bytes;
+  }
+
+  void reserve(std::size_t size) {
+    ForEachField([&](auto i) { std::get<i>(columns_).reserve(size); });
+  }
+
+  void resize(std::size_t size) {
+    ForEachField([&](auto i) { std::get<i>(columns_).resize(size); });
+  }
+
+  void emplace_back(const T& value) {
+    ForEachField([&](auto i) {
+      std::get<i>(columns_).emplace_back(value.*std::get<i>(fields));
+    });
+  }
+
+  void append(std::size_t count, const T& value) {
+    ForEachField([&](auto i) {
+      auto& column = std::get<i>(columns_);
+      column.insert(std::end(column), count, value.*std::get<i>(fields));
+    });
+  }
+
+  void pop_back() {
+    ForEachField([&](auto i) { std::get<i>(columns_).pop_back(); });
+  }
+
+  void swap(SoaVector& other) { columns_.swap(other.columns_); }
+
+  void assign_columns(const SoaVector& other, std::uint64_t mask) {
+    ForEachField([&](auto i) {
+      if (mask & (std::uint64_t(1) << i))
+        std::get<i>(columns_) = std::get<i>(other.columns_);
+    });
+  }
+
+  Reference<SoaVector> operator[](std::size_t i) { return {this, i}; }
+  Reference<const SoaVector> operator[](std::size_t i) const {
+    return {this, i};
+  }
+
+  Reference<SoaVector> back() { return {this, size() - 1}; }
+  Reference<const SoaVector> back() const { return {this, size() - 1}; }
+
+  template <typename F>
+  static void ForEachField(F&& func) {
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      (func(std::integral_constant<std::size_t, Is>{}), ...);
+    }(std::make_index_sequence<field_count>{});
+  }
+
+ private:
+  template <std::size_t... Is>
+  static auto MakeColumns(std::index_sequence<Is...>)
+      -> std::tuple<column_t<Is>...>;
+
+  decltype(MakeColumns(std::make_index_sequence<field_count>{})) columns_;
+};
+
+template <typename V, typename Ent>
+class SoaComponents {
+ public:
+  using Dirty = std::atomic<std::uint64_t>;
+
+  SoaComponents(V* comps, std::vector<Ent>* ents, Dirty* dirty = nullptr)
+      : components(comps), entities(ents), dirty(dirty) {}
+  SoaComponents& operator=(const SoaComponents& copy) = delete;
+
+  static void Mark(Dirty* dirty, std::uint64_t columns) {
+    if (dirty) dirty->fetch_or(columns, std::memory_order_relaxed);
+  }
+
+  template <std::size_t W>
+  class Chunk {
+   public:
+    Chunk(V* comps, std::size_t offset, std::size_t count,
+          Dirty* dirty = nullptr)
+        : components(comps), offset(offset), count(count), dirty(dirty) {}
+
+    template <std::size_t I>
+    auto column() const {
+      Mark(dirty, std::uint64_t(1) << I);
+      return components->template column<I>() + offset;
+    }
+
+    auto size() const { return count; }
+    auto full() const { return count == W; }
+
+    V* components;
+    std::size_t offset;
+    std::size_t count;
+    Dirty* dirty;
+  };
+
+  template <std::size_t W>
+  class ChunkRange {
+   public:
+    ChunkRange(V* comps, Dirty* dirty = nullptr)
+        : components(comps), dirty(dirty) {}
+
+    class iterator {
+     public:
+      iterator(V* comps, std::size_t offset, Dirty* dirty)
+          : components(comps), offset(offset), dirty(dirty) {}
+
+      auto operator++() {
+        offset += W;
+        return *this;
+      }
+      bool operator!=(const iterator& other) {
+        return other.offset != offset;
+      }
+      auto operator*() {
+        return Chunk<W>(components, offset,
+                        std::min(W, components->size() - offset), dirty);
+      }
+
+     private:
+      V* components;
+      std::size_t offset;
+      Dirty* dirty;
+    };
+
+    auto begin() { return iterator(components, 0, dirty); }
+    auto end() {
+      if (!components) return iterator(components, 0, dirty);
+      return iterator(components, (components->size() + W - 1) / W * W,
+                      dirty);
+    }
+
+   private:
+    V* components;
+    Dirty* dirty;
+  };
+
+  template <typename T1>
+  class iterator {
+   public:
+    iterator(T1 comps, Ent* ent, std::size_t ind)
+        : components(comps), entity(ent), ind(ind) {}
+
+    auto operator++() {
+      ++ind;
+      return *this;
+    }
+    bool operator!=(const iterator& other) { return other.ind != ind; }
+    auto operator*() {
+      return std::make_tuple((*components)[ind], std::ref(entity[ind]));
+    }
+
+   private:
+    T1 components;
+    Ent* entity;
+    std::size_t ind;
+  };
+
+  template <std::size_t I>
+  auto column() {
+    Mark(dirty, std::uint64_t(1) << I);
+    return components ? components->template column<I>() : nullptr;
+  }
+
+  template <std::size_t W>
+  auto Chunks() {
+    return ChunkRange<W>(components, dirty);
+  }
+
+  auto begin() {
+    Mark(dirty, V::all_columns);
+    if (components) return iterator<V*>(components, entities->data(), 0);
+    return iterator<V*>(nullptr, nullptr, 0);
+  }
+
+  auto end() {
+    if (components) return iterator<V*>(components, entities->data(), size());
+    return iterator<V*>(nullptr, nullptr, 0);
+  }
+
+  auto size() {
+    if (components && entities)
+      return std::min(components->size(), entities->size());
+    return std::size_t(0);
+  }
+
+  auto empty() { return size() == 0; }
+
+  auto operator[](std::size_t i) {
+    Mark(dirty, V::all_columns);
+    return std::make_tuple((*components)[i], std::ref((*entities)[i]));
+  }
+
+  V* components{nullptr};
+  std::vector<Ent>* entities{nullptr};
+  Dirty* dirty{nullptr};
+};
+}  // namespace ecs
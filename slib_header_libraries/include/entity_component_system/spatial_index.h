@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace ecs {
+template <typename Ent>
+class SpatialHashGrid {
+ public:
+  using position_t = std::array<float, 3>;
+
+  SpatialHashGrid(float cell_size) : inv_cell_size_(1.f / cell_size) {}
+
+  void Insert(const Ent& entity, const position_t& position) {
+    auto cell = CellKey(position);
+    if (auto it = locations_.find(entity); it != std::end(locations_)) {
+      auto& loc = it->second;
+      if (loc.cell == cell) {
+        cells_[cell][loc.ind].position = position;
+        return;
+      }
+      Erase(loc);
+      auto& entries = cells_[cell];
+      loc = {cell, entries.size()};
+      entries.push_back({entity, position});
+      return;
+    }
+
+    auto& entries = cells_[cell];
+    locations_.emplace(entity, Location{cell, entries.size()});
+    entries.push_back({entity, position});
+  }
+
+  void Remove(const Ent& entity) {
+    if (auto it = locations_.find(entity); it != std::end(locations_)) {
+      Erase(it->second);
+      locations_.erase(it);
+    }
+  }
+
+  void Clear() {
+    cells_.clear();
+    locations_.clear();
+  }
+
+  size_t size() const { return locations_.size(); }
+
+  template <typename F>
+  void QueryBox(const position_t& min, const position_t& max, F&& func) const {
+    auto lo = Cell(min);
+    auto hi = Cell(max);
+
+    double cell_count{1};
+    for (size_t i = 0; i < 3; ++i) cell_count *= double(hi[i]) - lo[i] + 1;
+    if (cell_count > double(cells_.size())) {
+      for (auto& [key, entries] : cells_)
+        for (auto& entry : entries)
+          if (Inside(entry.position, min, max))
+            func(entry.entity, entry.position);
+      return;
+    }
+
+    for (auto x = lo[0]; x <= hi[0]; ++x)
+      for (auto y = lo[1]; y <= hi[1]; ++y)
+        for (auto z = lo[2]; z <= hi[2]; ++z) {
+          auto it = cells_.find(Pack({x, y, z}));
+          if (it == std::end(cells_)) continue;
+          for (auto& entry : it->second)
+            if (Inside(entry.position, min, max))
+              func(entry.entity, entry.position);
+        }
+  }
+
+  template <typename F>
+  void QueryRadius(const position_t& center, float radius, F&& func) const {
+    auto radius_sq = radius * radius;
+    QueryBox({center[0] - radius, center[1] - radius, center[2] - radius},
+             {center[0] + radius, center[1] + radius, center[2] + radius},
+             [&](const Ent& entity, const position_t& position) {
+               float dist_sq{0};
+               for (size_t i = 0; i < 3; ++i) {
+                 auto delta = position[i] - center[i];
+                 dist_sq += delta * delta;
+               }
+               if (dist_sq <= radius_sq) func(entity, position);
+             });
+  }
+
+  std::vector<Ent> QueryBox(const position_t& min,
+                            const position_t& max) const {
+    std::vector<Ent> out;
+    QueryBox(min, max,
+             [&](const Ent& entity, auto&) { out.push_back(entity); });
+    return out;
+  }
+
+  std::vector<Ent> QueryRadius(const position_t& center, float radius) const {
+    std::vector<Ent> out;
+    QueryRadius(center, radius,
+                [&](const Ent& entity, auto&) { out.push_back(entity); });
+    return out;
+  }
+
+ private:
+  struct Entry {
+    Ent entity;
+    position_t position;
+  };
+
+  struct Location {
+    std::uint64_t cell;
+    size_t ind;
+  };
+
+  std::array<std::int32_t, 3> Cell(const position_t& position) const {
+    return {std::int32_t(std::floor(position[0] * inv_cell_size_)),
+            std::int32_t(std::floor(position[1] * inv_cell_size_)),
+            std::int32_t(std::floor(position[2] * inv_cell_size_))};
+  }
+
+  static std::uint64_t Pack(const std::array<std::int32_t, 3>& cell) {
+    auto bits = [](std::int32_t v) {
+      return std::uint64_t(std::uint32_t(v) & 0x1fffff);
+    };
+    return bits(cell[0]) | bits(cell[1]) << 21 | bits(cell[2]) << 42;
+  }
+
+  std::uint64_t CellKey(const position_t& position) const {
+    return Pack(Cell(position));
+  }
+
+  static bool Inside(const position_t& p, const position_t& min,
+                     const position_t& max) {
+    return p[0] >= min[0] && p[0] <= max[0] && p[1] >= min[1] &&
+           p[1] <= max[1] && p[2] >= min[2] && p[2] <= max[2];
+  }
+
+  void Erase(const Location& loc) {
+    auto cell_it = cells_.find(loc.cell);
+    auto& entries = cell_it->second;
+    if (loc.ind + 1 != entries.size()) {
+      entries[loc.ind] = std::move(entries.back());
+      locations_[entries[loc.ind].entity].ind = loc.ind;
+    }
+    entries.pop_back();
+    if (entries.empty()) cells_.erase(cell_it);
+  }
+
+  float inv_cell_size_;
+  std::unordered_map<std::uint64_t, std::vector<Entry>> cells_;
+  std::unordered_map<Ent, Location> locations_;
+};
+}  // namespace ecs
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <typeindex>
 #include <unordered_map>
+#include <vector>
 
 #include "../tbb_templates.hpp"
+#include "command_buffer.h"
+#include "deferred_queue.h"
+#include "system_task.h"
 
 #ifdef UNIT_TEST
 #include "system_manager_mock.h"
@@ -16,6 +30,9 @@ template <typename EntMgr>
 class SystemManager {
  public:
   SystemManager() = default;
+  ~SystemManager() {
+    background_arena_.execute([this]() { background_group_.wait(); });
+  }
 
 #ifdef UNIT_TEST
   SystemManager(SystemManagerMock* mock) : mock_(mock) {}
@@ -24,117 +41,543 @@ class SystemManager {
 
   void Step(EntMgr& ent_mgr) {
 #ifdef UNIT_TEST
-    if (mock_) mock_->Step(ent_mgr);
-    return;
+    if (mock_) return mock_->Step(ent_mgr);
+#endif
+    Run(Schedule(), ent_mgr);
+    ApplyTasks(&ent_mgr);
+  }
+
+  template <typename ShardedEntMgr>
+  void StepShards(ShardedEntMgr& sharded_ent_mgr) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->StepShards();
+#endif
+    auto& order = Schedule();
+    for (size_t shard = 0; shard < sharded_ent_mgr.ShardCount(); ++shard)
+      sharded_ent_mgr.Execute(shard,
+                              [&](EntMgr& ent_mgr) { Run(order, ent_mgr); });
+    ApplyTasks(nullptr);
+  }
+
+  using Task = std::shared_ptr<OffloadTask<EntMgr>>;
+
+  template <typename F>
+  Task Launch(EntMgr& ent_mgr, F&& job, std::uint32_t frames = 1) {
+#ifdef UNIT_TEST
+    if (mock_) return std::any_cast<Task>(mock_->Launch(frames));
 #endif
-    for (auto& execution_group : execution_order_)
-      tbb_templates::parallel_for(execution_group, [&](size_t i) {
-        execution_group[i]->execute(ent_mgr);
+    auto task = std::make_shared<OffloadTask<EntMgr>>(
+        &ent_mgr, frame_.load(std::memory_order_relaxed) + frames);
+    launched_tasks_.push_back(task);
+    background_arena_.execute([&]() {
+      background_group_.run([task, job = std::forward<F>(job)]() {
+        if (!task->Cancelled()) {
+          try {
+            job(task->commands);
+          } catch (...) {
+            task->exception = std::current_exception();
+          }
+        }
+        task->state_.store(TaskState::kReady, std::memory_order_release);
       });
+    });
+    return task;
+  }
+
+  void SetFrameBudget(std::chrono::nanoseconds budget,
+                      std::uint32_t max_deferred_frames = 4) {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->SetFrameBudget(budget, max_deferred_frames);
+#endif
+    budget_ = budget;
+    max_deferred_frames_ = max_deferred_frames;
+  }
+
+  bool OverBudget() const {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->OverBudget();
+#endif
+    return budget_.count() != 0 &&
+           std::chrono::steady_clock::now() >= deadline_;
+  }
+
+  std::chrono::nanoseconds TimeLeft() const {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->TimeLeft();
+#endif
+    if (budget_.count() == 0) return std::chrono::nanoseconds::max();
+    return std::max(std::chrono::nanoseconds(0),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        deadline_ - std::chrono::steady_clock::now()));
+  }
+
+  template <typename F>
+  bool TimeSlice(size_t& cursor, size_t count, F&& func, size_t batch = 64) {
+    while (cursor < count) {
+      auto end = std::min(count, cursor + batch);
+      for (; cursor < end; ++cursor) func(cursor);
+      if (cursor < count && OverBudget()) return false;
+    }
+    cursor = 0;
+    return true;
   }
 
   struct SystemHolder {
+    std::type_index type{typeid(void)};
+    std::uint32_t id{0};
     std::any system;
     std::function<void(EntMgr&)> execute;
-    std::function<std::vector<std::type_index>()> dependencies;
+    std::function<void(void)> sync;
+    std::vector<std::type_index> dependencies;
+    std::vector<SystemHolder*> upstream;
+    std::vector<SystemHolder*> downstream;
+    size_t level{0};
+    size_t slot{kUnplaced};
+    size_t stamp{0};
+    size_t mark{0};
+    size_t index{0};
+    size_t low{0};
+    bool on_stack{false};
+    int priority{0};
+    bool deferrable{false};
+    std::uint32_t deferred_frames{0};
+    std::atomic<std::int64_t> cost{0};
   };
 
   template <typename T>
   void AddSystem() {
 #ifdef UNIT_TEST
-    if (mock_) mock_->AddSystem(typeid(T));
-    return;
+    if (mock_) return mock_->AddSystem(typeid(T));
 #endif
     add_system_cache_.push_back([this]() {
-      SystemHolder sys_holder;
       auto sys = std::make_shared<T>();
+      auto [it, inserted] = systems_.try_emplace(typeid(T));
+      sys->Init();
+      if (!inserted) return;
+
+      auto& sys_holder = it->second;
       std::weak_ptr<T> sys_weak = sys;
+      sys_holder.type = typeid(T);
+      sys_holder.id = next_system_id_++;
       sys_holder.system = std::any(sys);
-      sys_holder.execute = [this, sys_weak](EntMgr& ent_mgr) {
-        if (auto sys = sys_weak.lock(); sys) sys->Step(ent_mgr, *this);
-      };
-      sys_holder.dependencies = [sys_weak]() -> auto{
-        if (auto sys = sys_weak.lock(); sys) return sys->Dependencies();
-        return std::vector<std::type_index>{};
-      };
-      systems_.emplace(typeid(T), sys_holder);
-      sys->Init();
+      if constexpr (std::is_same_v<decltype(sys->Step(
+                                       std::declval<EntMgr&>(), *this)),
+                                   SystemTask>) {
+        auto tasks = std::make_shared<
+            tbb::concurrent_unordered_map<EntMgr*, SystemTask>>();
+        sys_holder.execute = [this, sys_weak, tasks](EntMgr& ent_mgr) {
+          auto& task = (*tasks)[&ent_mgr];
+          if (task.Resumable()) return task.Resume();
+          if (!task.Done()) return;
+          if (auto sys = sys_weak.lock(); sys) {
+            task = sys->Step(ent_mgr, *this);
+            task.Rethrow();
+          }
+        };
+        sys_holder.sync = [tasks]() {
+          for (auto& [ent_mgr, task] : *tasks)
+            if (task.Waiting(TaskWait::kSyncPoint)) task.Resume();
+        };
+      } else {
+        sys_holder.execute = [this, sys_weak](EntMgr& ent_mgr) {
+          if (auto sys = sys_weak.lock(); sys) sys->Step(ent_mgr, *this);
+        };
+      }
+      sys_holder.dependencies = sys->Dependencies();
+      if constexpr (requires { sys->Priority(); })
+        sys_holder.priority = sys->Priority();
+      if constexpr (requires { sys->Deferrable(); })
+        sys_holder.deferrable = sys->Deferrable();
+      Link(sys_holder);
     });
   }
 
   template <typename T>
   void RemoveSystem() {
 #ifdef UNIT_TEST
-    if (mock_) mock_->RemoveSystem(typeid(T));
-    return;
+    if (mock_) return mock_->RemoveSystem(typeid(T));
 #endif
-    remove_system_cache_.push_back([this]() { systems_.erase(typeid(T)); });
+    remove_system_cache_.push_back([this]() {
+      if (auto it = systems_.find(typeid(T)); it != std::end(systems_)) {
+        Unlink(it->second);
+        systems_.erase(it);
+      }
+    });
   }
 
   template <typename T>
   T* System() {
 #ifdef UNIT_TEST
-    if (mock_) std::any_cast<T*>(mock_->System(typeid(T)));
-    return nullptr;
+    if (mock_) return std::any_cast<T*>(mock_->System(typeid(T)));
 #endif
     if (auto it = systems_.find(typeid(T)); it != std::end(systems_))
       return std::any_cast<std::shared_ptr<T>>(it->second.system).get();
     return nullptr;
   }
 
+  template <typename T>
+  std::uint32_t DeferredFrames() const {
+#ifdef UNIT_TEST
+    if (mock_) return mock_->DeferredFrames(typeid(T));
+#endif
+    if (auto it = systems_.find(typeid(T)); it != std::end(systems_))
+      return it->second.deferred_frames;
+    return 0;
+  }
+
+  template <typename T>
+  std::optional<size_t> ExecutionGroup() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<std::optional<size_t>>(
+          mock_->ExecutionGroup(typeid(T)));
+#endif
+    if (auto it = systems_.find(typeid(T)); it != std::end(systems_))
+      return it->second.level;
+    return std::nullopt;
+  }
+
+  const std::vector<std::vector<std::type_index>>& DependencyCycles() const {
+#ifdef UNIT_TEST
+    if (mock_)
+      return std::any_cast<const std::vector<std::vector<std::type_index>>&>(
+          mock_->DependencyCycles());
+#endif
+    return cycles_;
+  }
+
   void SyncSystems() {
 #ifdef UNIT_TEST
-    if (mock_) mock_->SyncSystems();
-    return;
+    if (mock_) return mock_->SyncSystems();
 #endif
-    for (auto& sys : add_system_cache_) sys();
-    for (auto& sys : remove_system_cache_) sys();
+    for (auto& [type, sys] : systems_)
+      if (sys.sync) sys.sync();
 
-    if (!remove_system_cache_.empty() || !add_system_cache_.empty())
-      CalculateExecutionOrder();
+    add_system_cache_.Canonicalize();
+    add_system_cache_.ForEach([](auto& sys) { sys(); });
+    remove_system_cache_.Canonicalize();
+    remove_system_cache_.ForEach([](auto& sys) { sys(); });
 
     remove_system_cache_.clear();
     add_system_cache_.clear();
   }
 
  private:
-  void CalculateExecutionOrder() {
-    std::unordered_map<std::type_index, size_t> group_ids;
-    bool repeat = true;
-    while (repeat) {
-      repeat = false;
-      for (const auto& [type_ind, sys] : systems_) {
-        auto deps = sys.dependencies();
-        auto& group_id = group_ids[type_ind];
-        for (auto d : deps) {
-          auto dep_it = systems_.find(d);
-          if (dep_it != std::end(systems_)) {
-            auto dep_group_id = group_ids[d];
-            auto deps_deps = dep_it->second.dependencies();
-            auto it = std::find(deps_deps.begin(), deps_deps.end(), type_ind);
-            if (dep_group_id >= group_id && it == std::end(deps_deps)) {
-              group_id = dep_group_id + 1;
-              repeat = true;
-            }
-          }
+  static constexpr size_t kUnplaced{static_cast<size_t>(-1)};
+
+  void ApplyTasks(const EntMgr* ent_mgr) {
+    launched_tasks_.Canonicalize();
+    launched_tasks_.ForEach(
+        [this](Task& task) { tasks_.push_back(std::move(task)); });
+    launched_tasks_.clear();
+
+    auto frame = frame_.load(std::memory_order_relaxed);
+    std::exception_ptr exception;
+    size_t kept{0};
+    for (auto& task : tasks_) {
+      auto state = task->State();
+      if ((ent_mgr && task->ent_mgr != ent_mgr) ||
+          state == TaskState::kRunning ||
+          (!task->Cancelled() && frame < task->apply_frame)) {
+        tasks_[kept++] = std::move(task);
+        continue;
+      }
+
+      if (task->exception) {
+        if (exception)
+          LogDropped(task->exception);
+        else
+          exception = task->exception;
+        task->state_.store(TaskState::kCancelled, std::memory_order_release);
+      } else if (task->Cancelled() || !task->commands.TargetsAlive()) {
+        task->commands.Clear();
+        task->state_.store(TaskState::kCancelled, std::memory_order_release);
+      } else {
+        task->applied = task->commands.Apply(*task->ent_mgr);
+        task->state_.store(TaskState::kApplied, std::memory_order_release);
+      }
+    }
+    tasks_.resize(kept);
+    if (exception) std::rethrow_exception(exception);
+  }
+
+  static void LogDropped(const std::exception_ptr& exception) {
+    try {
+      std::rethrow_exception(exception);
+    } catch (const std::exception& e) {
+      std::cerr << "Offload task failed: " << e.what() << std::endl;
+    } catch (...) {
+      std::cerr << "Offload task failed" << std::endl;
+    }
+  }
+
+  const std::vector<std::vector<SystemHolder*>>& Schedule() {
+    frame_.fetch_add(1, std::memory_order_relaxed);
+    deadline_ = std::chrono::steady_clock::now() + budget_;
+    while (group_costs_.size() < execution_order_.size())
+      group_costs_.emplace_back();
+    if (budget_.count() == 0) return execution_order_;
+
+    auto remaining = budget_.count();
+    for (auto& execution_group : execution_order_) {
+      std::int64_t group_cost{0};
+      for (auto sys : execution_group)
+        if (!sys->deferrable)
+          group_cost = std::max(group_cost, sys->cost.load());
+      remaining -= group_cost;
+    }
+
+    frame_order_.resize(execution_order_.size());
+    for (size_t g = 0; g < execution_order_.size(); ++g) {
+      auto& group = frame_order_[g];
+      group.clear();
+      worklist_.clear();
+      for (auto sys : execution_order_[g])
+        (sys->deferrable ? worklist_ : group).push_back(sys);
+
+      std::sort(worklist_.begin(), worklist_.end(), [](auto lhs, auto rhs) {
+        return lhs->priority + lhs->deferred_frames >
+               rhs->priority + rhs->deferred_frames;
+      });
+      for (auto sys : worklist_) {
+        auto cost = sys->cost.load();
+        if (cost <= remaining || sys->deferred_frames >= max_deferred_frames_) {
+          remaining -= cost;
+          sys->deferred_frames = 0;
+          group.push_back(sys);
+        } else {
+          ++sys->deferred_frames;
         }
       }
     }
+    return frame_order_;
+  }
+
+  void Run(const std::vector<std::vector<SystemHolder*>>& order,
+           EntMgr& ent_mgr) {
+    for (size_t g = 0; g < order.size(); ++g) {
+      auto& execution_group = order[g];
+      group_costs_[g].parallel_for(execution_group.size(), [&](size_t i) {
+        auto& sys = *execution_group[i];
+        auto start = std::chrono::steady_clock::now();
+        {
+          tbb_templates::TaskKeyScope scope(sys.id, 0);
+          sys.execute(ent_mgr);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+        auto cost = sys.cost.load(std::memory_order_relaxed);
+        sys.cost.store(cost ? (cost * 7 + elapsed) / 8 : elapsed,
+                       std::memory_order_relaxed);
+      });
+    }
+  }
 
-    execution_order_.clear();
-    if (!group_ids.empty()) {
-      for (const auto& [type_ind, prio] : group_ids) {
-        while (prio >= execution_order_.size()) execution_order_.emplace_back();
-        execution_order_[prio].emplace_back(&systems_[type_ind]);
+  void Link(SystemHolder& sys) {
+    for (auto dep : sys.dependencies) {
+      dependents_[dep].push_back(sys.type);
+      if (auto it = systems_.find(dep); it != std::end(systems_)) {
+        sys.upstream.push_back(&it->second);
+        it->second.downstream.push_back(&sys);
+      }
+    }
+    if (auto it = dependents_.find(sys.type); it != std::end(dependents_)) {
+      for (auto type : it->second) {
+        auto dep_it = systems_.find(type);
+        if (dep_it == std::end(systems_)) continue;
+        sys.downstream.push_back(&dep_it->second);
+        dep_it->second.upstream.push_back(&sys);
       }
     }
+
+    if (!cycles_.empty() || ClosesCycle(sys)) return CalculateExecutionOrder();
+
+    sys.level = UpstreamLevel(sys);
+    Place(sys);
+    worklist_.assign(1, &sys);
+    while (!worklist_.empty()) {
+      auto cur = worklist_.back();
+      worklist_.pop_back();
+      for (auto next : cur->downstream) {
+        if (next->level > cur->level) continue;
+        Move(*next, cur->level + 1);
+        worklist_.push_back(next);
+      }
+    }
+  }
+
+  void Unlink(SystemHolder& sys) {
+    Unplace(sys);
+    for (auto dep : sys.dependencies) {
+      if (auto it = dependents_.find(dep); it != std::end(dependents_)) {
+        auto& types = it->second;
+        types.erase(std::find(types.begin(), types.end(), sys.type));
+        if (types.empty()) dependents_.erase(it);
+      }
+    }
+
+    ++stamp_;
+    worklist_.clear();
+    for (auto next : sys.downstream) {
+      Detach(next->upstream, &sys);
+      Collect(*next);
+    }
+    for (auto prev : sys.upstream) Detach(prev->downstream, &sys);
+
+    if (!cycles_.empty()) {
+      sys.level = kUnplaced;
+      return CalculateExecutionOrder(&sys);
+    }
+
+    std::sort(worklist_.begin(), worklist_.end(),
+              [](auto lhs, auto rhs) { return lhs->level < rhs->level; });
+    for (auto cur : worklist_) Move(*cur, UpstreamLevel(*cur));
+    TrimGroups();
+  }
+
+  void Collect(SystemHolder& sys) {
+    if (sys.stamp == stamp_) return;
+    sys.stamp = stamp_;
+    worklist_.push_back(&sys);
+    for (auto next : sys.downstream) Collect(*next);
+  }
+
+  bool ClosesCycle(SystemHolder& sys) {
+    if (sys.upstream.empty() || sys.downstream.empty()) return false;
+    ++stamp_;
+    for (auto prev : sys.upstream) prev->mark = stamp_;
+    worklist_.assign(1, &sys);
+    sys.stamp = stamp_;
+    while (!worklist_.empty()) {
+      auto cur = worklist_.back();
+      worklist_.pop_back();
+      for (auto next : cur->downstream) {
+        if (next->mark == stamp_) return true;
+        if (next->stamp == stamp_) continue;
+        next->stamp = stamp_;
+        worklist_.push_back(next);
+      }
+    }
+    return false;
+  }
+
+  static void Detach(std::vector<SystemHolder*>& holders, SystemHolder* sys) {
+    auto it = std::find(holders.begin(), holders.end(), sys);
+    if (it == std::end(holders)) return;
+    std::swap(*it, holders.back());
+    holders.pop_back();
+  }
+
+  static size_t UpstreamLevel(const SystemHolder& sys) {
+    size_t level{0};
+    for (auto prev : sys.upstream) level = std::max(level, prev->level + 1);
+    return level;
+  }
+
+  void Place(SystemHolder& sys) {
+    if (sys.level >= execution_order_.size())
+      execution_order_.resize(sys.level + 1);
+    auto& group = execution_order_[sys.level];
+    sys.slot = group.size();
+    group.push_back(&sys);
+  }
+
+  void Unplace(SystemHolder& sys) {
+    if (sys.slot == kUnplaced) return;
+    auto& group = execution_order_[sys.level];
+    group.back()->slot = sys.slot;
+    std::swap(group[sys.slot], group.back());
+    group.pop_back();
+    sys.slot = kUnplaced;
+  }
+
+  void Move(SystemHolder& sys, size_t level) {
+    if (sys.level == level && sys.slot != kUnplaced) return;
+    Unplace(sys);
+    sys.level = level;
+    Place(sys);
+  }
+
+  void TrimGroups() {
+    while (!execution_order_.empty() && execution_order_.back().empty())
+      execution_order_.pop_back();
+  }
+
+  void CalculateExecutionOrder(const SystemHolder* skip = nullptr) {
+    for (auto& group : execution_order_) group.clear();
+    cycles_.clear();
+    ++stamp_;
+    index_ = 0;
+    for (auto& [type, sys] : systems_) {
+      sys.slot = kUnplaced;
+      sys.on_stack = false;
+    }
+    for (auto& [type, sys] : systems_)
+      if (&sys != skip && sys.stamp != stamp_) Connect(sys);
+    TrimGroups();
+  }
+
+  void Connect(SystemHolder& sys) {
+    sys.stamp = stamp_;
+    sys.index = sys.low = index_++;
+    sys.on_stack = true;
+    scc_stack_.push_back(&sys);
+
+    for (auto prev : sys.upstream) {
+      if (prev->stamp != stamp_) {
+        Connect(*prev);
+        sys.low = std::min(sys.low, prev->low);
+      } else if (prev->on_stack) {
+        sys.low = std::min(sys.low, prev->index);
+      }
+    }
+    if (sys.low != sys.index) return;
+
+    auto first = std::find(scc_stack_.begin(), scc_stack_.end(), &sys);
+    size_t level{0};
+    for (auto it = first; it != std::end(scc_stack_); ++it) {
+      (*it)->on_stack = false;
+      for (auto prev : (*it)->upstream)
+        if (prev->slot != kUnplaced) level = std::max(level, prev->level + 1);
+    }
+
+    if (std::distance(first, std::end(scc_stack_)) > 1) {
+      auto& cycle = cycles_.emplace_back();
+      for (auto it = first; it != std::end(scc_stack_); ++it)
+        cycle.push_back((*it)->type);
+    }
+    for (auto it = first; it != std::end(scc_stack_); ++it) {
+      (*it)->level = level;
+      Place(**it);
+    }
+    scc_stack_.erase(first, std::end(scc_stack_));
   }
 
   std::vector<std::vector<SystemHolder*>> execution_order_;
   std::unordered_map<std::type_index, SystemHolder> systems_;
+  std::unordered_map<std::type_index, std::vector<std::type_index>> dependents_;
+  std::vector<std::vector<std::type_index>> cycles_;
+  std::vector<SystemHolder*> worklist_;
+  std::vector<SystemHolder*> scc_stack_;
+  std::vector<std::vector<SystemHolder*>> frame_order_;
+  std::chrono::nanoseconds budget_{0};
+  std::uint32_t max_deferred_frames_{4};
+  std::chrono::steady_clock::time_point deadline_;
+  std::atomic<std::uint64_t> frame_{0};
+  std::deque<tbb_templates::CostModel> group_costs_;
+
+  tbb::task_arena background_arena_{tbb::task_arena::automatic, 0,
+                                    tbb::task_arena::priority::low};
+  tbb::task_group background_group_;
+  DeferredQueue<Task> launched_tasks_;
+  std::vector<Task> tasks_;
+  size_t stamp_{0};
+  size_t index_{0};
 
-  tbb::concurrent_vector<std::function<void(void)>> add_system_cache_;
-  tbb::concurrent_vector<std::function<void(void)>> remove_system_cache_;
+  DeferredQueue<std::function<void(void)>> add_system_cache_;
+  DeferredQueue<std::function<void(void)>> remove_system_cache_;
+  std::uint32_t next_system_id_{1};
 };
 
 }  // namespace ecs
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "../tbb_templates.hpp"
+
+namespace ecs {
+enum class TaskWait : std::uint8_t {
+  kNone,
+  kNextFrame,
+  kSyncPoint,
+  kBackground
+};
+
+class SystemTask {
+ public:
+  struct promise_type {
+    SystemTask get_return_object() {
+      return SystemTask(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    TaskWait wait{TaskWait::kNone};
+    std::atomic<bool> ready{false};
+    std::exception_ptr exception;
+  };
+
+  SystemTask() = default;
+  SystemTask(const SystemTask&) = delete;
+  SystemTask(SystemTask&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  SystemTask& operator=(SystemTask&& other) noexcept {
+    if (this != &other) {
+      Destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~SystemTask() { Destroy(); }
+
+  bool Done() const { return !handle_ || handle_.done(); }
+
+  bool Waiting(TaskWait wait) const {
+    return !Done() && handle_.promise().wait == wait;
+  }
+
+  bool Resumable() const {
+    if (Done()) return false;
+    auto& promise = handle_.promise();
+    return promise.wait == TaskWait::kNextFrame ||
+           (promise.wait == TaskWait::kBackground &&
+            promise.ready.load(std::memory_order_acquire));
+  }
+
+  void Resume() {
+    handle_.promise().wait = TaskWait::kNone;
+    handle_.resume();
+    Rethrow();
+  }
+
+  void Rethrow() {
+    if (handle_ && handle_.promise().exception)
+      std::rethrow_exception(std::exchange(handle_.promise().exception, {}));
+  }
+
+ private:
+  explicit SystemTask(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  void Destroy() {
+    if (!handle_) return;
+    auto& promise = handle_.promise();
+    if (!handle_.done() && promise.wait == TaskWait::kBackground)
+      while (!promise.ready.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    handle_.destroy();
+    handle_ = nullptr;
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <TaskWait Wait>
+struct TaskSuspend {
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<SystemTask::promise_type> handle) {
+    handle.promise().wait = Wait;
+  }
+  void await_resume() const noexcept {}
+};
+
+using NextFrame = TaskSuspend<TaskWait::kNextFrame>;
+using SyncPoint = TaskSuspend<TaskWait::kSyncPoint>;
+
+template <typename F>
+class Background {
+ public:
+  using result_t = std::invoke_result_t<F>;
+
+  explicit Background(F func) : func_(std::move(func)) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<SystemTask::promise_type> handle) {
+    auto& promise = handle.promise();
+    promise.wait = TaskWait::kBackground;
+    promise.ready.store(false, std::memory_order_relaxed);
+    tbb::this_task_arena::enqueue([this, &promise]() {
+      try {
+        if constexpr (std::is_void_v<result_t>)
+          func_();
+        else
+          result_.emplace(func_());
+      } catch (...) {
+        exception_ = std::current_exception();
+      }
+      promise.ready.store(true, std::memory_order_release);
+    });
+  }
+
+  result_t await_resume() {
+    if (exception_) std::rethrow_exception(exception_);
+    if constexpr (!std::is_void_v<result_t>) return std::move(*result_);
+  }
+
+ private:
+  F func_;
+  std::conditional_t<std::is_void_v<result_t>, bool, std::optional<result_t>>
+      result_;
+  std::exception_ptr exception_;
+};
+}  // namespace ecs
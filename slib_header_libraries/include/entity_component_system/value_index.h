@@ -0,0 +1,177 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+template <typename K, typename V, typename Hash = std::hash<K>>
+class OpenHashMap {
+ public:
+  OpenHashMap() { Rehash(16); }
+
+  V* Find(const K& key) {
+    return const_cast<V*>(std::as_const(*this).Find(key));
+  }
+
+  const V* Find(const K& key) const {
+    for (auto i = Home(key);; i = Next(i)) {
+      auto& slot = slots_[i];
+      if (!slot) return nullptr;
+      if (slot->first == key) return &slot->second;
+    }
+  }
+
+  template <typename... Args>
+  std::pair<V*, bool> TryEmplace(const K& key, Args&&... args) {
+    if ((size_ + 1) * 4 > slots_.size() * 3) Rehash(slots_.size() * 2);
+    for (auto i = Home(key);; i = Next(i)) {
+      auto& slot = slots_[i];
+      if (!slot) {
+        slot.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                     std::forward_as_tuple(std::forward<Args>(args)...));
+        ++size_;
+        return {&slot->second, true};
+      }
+      if (slot->first == key) return {&slot->second, false};
+    }
+  }
+
+  bool Erase(const K& key) {
+    auto hole = Home(key);
+    for (;; hole = Next(hole)) {
+      if (!slots_[hole]) return false;
+      if (slots_[hole]->first == key) break;
+    }
+
+    for (auto i = Next(hole); slots_[i]; i = Next(i)) {
+      auto home = Home(slots_[i]->first);
+      if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+        slots_[hole] = std::move(slots_[i]);
+        hole = i;
+      }
+    }
+    slots_[hole].reset();
+    --size_;
+    return true;
+  }
+
+  void Clear() {
+    for (auto& slot : slots_) slot.reset();
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  size_t Home(const K& key) const {
+    return (std::uint64_t(Hash{}(key)) * 0x9E3779B97F4A7C15ull) >> shift_;
+  }
+  size_t Next(size_t i) const { return (i + 1) & mask_; }
+
+  void Rehash(size_t capacity) {
+    auto old = std::move(slots_);
+    slots_ = std::vector<std::optional<std::pair<K, V>>>(capacity);
+    mask_ = capacity - 1;
+    shift_ = 64 - std::countr_zero(capacity);
+
+    for (auto& slot : old) {
+      if (!slot) continue;
+      auto i = Home(slot->first);
+      while (slots_[i]) i = Next(i);
+      slots_[i] = std::move(slot);
+    }
+  }
+
+  std::vector<std::optional<std::pair<K, V>>> slots_;
+  size_t size_{0};
+  size_t mask_{0};
+  int shift_{64};
+};
+
+enum class IndexKind { kUnique, kMulti };
+
+template <typename Key, typename Ent>
+class ValueIndex {
+ public:
+  ValueIndex(IndexKind kind) : kind_(kind) {}
+
+  bool Insert(const Ent& entity, const Key& key) {
+    if (auto old = keys_.Find(entity); old) {
+      if (*old == key) return true;
+      Detach(entity, *old);
+      keys_.Erase(entity);
+    }
+
+    if (kind_ == IndexKind::kUnique) {
+      if (!unique_.TryEmplace(key, entity).second) {
+        conflicts_.push_back(entity);
+        return false;
+      }
+    } else {
+      multi_.TryEmplace(key).first->push_back(entity);
+    }
+    keys_.TryEmplace(entity, key);
+    return true;
+  }
+
+  void Remove(const Ent& entity) {
+    if (auto old = keys_.Find(entity); old) {
+      Detach(entity, *old);
+      keys_.Erase(entity);
+    }
+  }
+
+  const Ent* Find(const Key& key) const {
+    if (kind_ == IndexKind::kUnique) return unique_.Find(key);
+    if (auto ents = multi_.Find(key); ents) return ents->data();
+    return nullptr;
+  }
+
+  std::span<const Ent> FindAll(const Key& key) const {
+    if (kind_ == IndexKind::kUnique) {
+      if (auto ent = unique_.Find(key); ent) return {ent, 1};
+      return {};
+    }
+    if (auto ents = multi_.Find(key); ents) return *ents;
+    return {};
+  }
+
+  const std::vector<Ent>& Conflicts() const { return conflicts_; }
+  void ClearConflicts() { conflicts_.clear(); }
+
+  IndexKind kind() const { return kind_; }
+  size_t size() const { return keys_.size(); }
+
+ private:
+  void Detach(const Ent& entity, const Key& key) {
+    if (kind_ == IndexKind::kUnique) {
+      if (auto owner = unique_.Find(key); owner && *owner == entity)
+        unique_.Erase(key);
+      return;
+    }
+
+    if (auto ents = multi_.Find(key); ents) {
+      for (auto& ent : *ents) {
+        if (ent != entity) continue;
+        std::swap(ent, ents->back());
+        ents->pop_back();
+        break;
+      }
+      if (ents->empty()) multi_.Erase(key);
+    }
+  }
+
+  IndexKind kind_;
+  OpenHashMap<Key, Ent> unique_;
+  OpenHashMap<Key, std::vector<Ent>> multi_;
+  OpenHashMap<Ent, Key> keys_;
+  std::vector<Ent> conflicts_;
+};
+}  // namespace ecs
@@ -1,69 +1,227 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <bit>
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace synchronization {
 template <typename T, size_t S = 10>
 class ChunkList {
+  static_assert(S > 1);
+
  public:
-  ChunkList() { chunk_ = std::make_unique<Chunk>(); }
+  ChunkList() {
+    auto id = AcquireChunk(0);
+    head_.store(Ref(id, 0), std::memory_order_relaxed);
+    tail_.store(Ref(id, 0), std::memory_order_relaxed);
+  }
 
-  bool empty() { return num_elements_ == 0; }
+  ~ChunkList() {
+    for (auto& segment : segments_) delete[] segment.load();
+  }
 
-  T* push_front(T c) {
-    size_t num_elem = num_elements_++;
-    size_t chunk_count = num_elem / S;
+  ChunkList(const ChunkList&) = delete;
+  ChunkList& operator=(const ChunkList&) = delete;
 
-    Chunk* chunk{nullptr};
-    do {
-      chunk = chunk_.get();
-      for (size_t i = 0; i < chunk_count; ++i) {
-        chunk = chunk->next;
-        if (!chunk) break;
-      }
-    } while (!chunk);
+  bool empty() const { return size() == 0; }
 
-    if (num_elem % S == S / 2 && !chunk->next) {
-      chunk->chunk = std::make_unique<Chunk>();
-      chunk->next = chunk->chunk.get();
-    }
+  size_t size() const {
+    auto dequeued = dequeue_pos_.load(std::memory_order_acquire);
+    auto enqueued = enqueue_pos_.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+  }
 
-    auto& be = chunk->buffer[(tail_ + num_elem) % S];
-    be = c;
-    return &be;
+  size_t chunk_count() const {
+    return next_id_.load(std::memory_order_relaxed);
   }
 
-  T* back() {
-    if (empty()) return nullptr;
-    Chunk* chunk = chunk_.get();
-    int chunk_count = tail_ / S;
-    for (int i = 0; i < chunk_count; ++i) chunk = chunk->next;
-    return &chunk->buffer[tail_ % S];
+  void push_front(T value) {
+    for (;;) {
+      auto tail = tail_.load(std::memory_order_acquire);
+      auto chunk = Get(Id(tail));
+      auto base = chunk->base.load(std::memory_order_acquire);
+      if (Tag(base) != RefTag(tail)) continue;
+
+      auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+      if (pos < base) continue;
+      if (pos >= base + S) {
+        auto next = chunk->next.load(std::memory_order_acquire);
+        if (RefTag(next) != Tag(base) ||
+            tail_.load(std::memory_order_acquire) != tail)
+          continue;
+        if (Id(next) == kNone)
+          Link(chunk, base);
+        else
+          tail_.compare_exchange_strong(tail, Ref(Id(next), base + S));
+        continue;
+      }
+
+      auto& slot = chunk->slots[pos - base];
+      if (slot.seq.load(std::memory_order_acquire) != pos) continue;
+      if (!enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+        continue;
+
+      if (pos == base) Link(chunk, base);
+      slot.value = std::move(value);
+      slot.seq.store(pos + 1, std::memory_order_release);
+      return;
+    }
   }
 
-  void pop_back() {
-    if (empty()) return;
-    ++tail_;
-    --num_elements_;
-    if (empty()) tail_ = 0;
+  bool try_pop(T& value) {
+    for (;;) {
+      auto head = head_.load(std::memory_order_acquire);
+      auto chunk = Get(Id(head));
+      auto base = chunk->base.load(std::memory_order_acquire);
+      if (Tag(base) != RefTag(head)) continue;
+
+      auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+      if (pos < base) continue;
+      if (pos >= base + S) {
+        auto next = chunk->next.load(std::memory_order_acquire);
+        if (RefTag(next) != Tag(base) ||
+            head_.load(std::memory_order_acquire) != head)
+          continue;
+        if (Id(next) == kNone) return false;
+        AdvanceHead(head, Ref(Id(next), base + S), chunk, Id(head));
+        continue;
+      }
+
+      auto& slot = chunk->slots[pos - base];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == pos) return false;
+      if (seq != pos + 1) continue;
+      if (!dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+        continue;
+
+      value = std::move(slot.value);
+      Release(chunk, Id(head));
+      return true;
+    }
   }
 
  private:
-  struct Chunk {
-    T buffer[S];
-    std::unique_ptr<Chunk> chunk;
-    Chunk* next{nullptr};
+  static constexpr std::uint32_t kNone{~std::uint32_t{0}};
+  static constexpr size_t kSegments{32};
+
+  struct Slot {
+    std::atomic<std::uint64_t> seq{0};
+    T value{};
+  };
+
+  struct alignas(64) Chunk {
+    std::atomic<std::uint64_t> base{0};
+    std::atomic<std::uint64_t> next{kNone};
+    std::atomic<std::uint32_t> free_next{kNone};
+    std::atomic<size_t> released{0};
+    Slot slots[S];
   };
 
-  std::unique_ptr<Chunk> chunk_;
+  static std::uint64_t Ref(std::uint32_t id, std::uint64_t base) {
+    return std::uint64_t(Tag(base)) << 32 | id;
+  }
+  static std::uint32_t Tag(std::uint64_t base) {
+    return std::uint32_t(base / S);
+  }
+  static std::uint32_t Id(std::uint64_t ref) { return std::uint32_t(ref); }
+  static std::uint32_t RefTag(std::uint64_t ref) {
+    return std::uint32_t(ref >> 32);
+  }
+
+  Chunk* Get(std::uint32_t id) {
+    auto index = size_t(id) + 1;
+    auto segment = std::bit_width(index) - 1;
+    return segments_[segment].load(std::memory_order_acquire) +
+           (index - (size_t(1) << segment));
+  }
+
+  std::uint32_t NewChunk() {
+    auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+    auto index = size_t(id) + 1;
+    auto segment = std::bit_width(index) - 1;
+    if (!segments_[segment].load(std::memory_order_acquire)) {
+      auto chunks = new Chunk[size_t(1) << segment];
+      Chunk* expected{nullptr};
+      if (!segments_[segment].compare_exchange_strong(
+              expected, chunks, std::memory_order_acq_rel))
+        delete[] chunks;
+    }
+    return id;
+  }
+
+  std::uint32_t AcquireChunk(std::uint64_t base) {
+    auto id = PopFree();
+    if (id == kNone) id = NewChunk();
+
+    auto chunk = Get(id);
+    chunk->next.store(Ref(kNone, base), std::memory_order_relaxed);
+    chunk->released.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < S; ++i)
+      chunk->slots[i].seq.store(base + i, std::memory_order_relaxed);
+    chunk->base.store(base, std::memory_order_release);
+    return id;
+  }
+
+  void Link(Chunk* chunk, std::uint64_t base) {
+    auto unlinked = Ref(kNone, base);
+    if (chunk->next.load(std::memory_order_acquire) != unlinked) return;
+    auto id = AcquireChunk(base + S);
+    if (!chunk->next.compare_exchange_strong(unlinked, Ref(id, base),
+                                             std::memory_order_acq_rel))
+      PushFree(id);
+  }
+
+  void AdvanceHead(std::uint64_t head, std::uint64_t next, Chunk* chunk,
+                   std::uint32_t id) {
+    auto tail = head;
+    tail_.compare_exchange_strong(tail, next, std::memory_order_acq_rel);
+    if (head_.compare_exchange_strong(head, next, std::memory_order_acq_rel))
+      Release(chunk, id);
+  }
+
+  void Release(Chunk* chunk, std::uint32_t id) {
+    if (chunk->released.fetch_add(1, std::memory_order_acq_rel) == S)
+      PushFree(id);
+  }
+
+  std::uint32_t PopFree() {
+    auto top = free_.load(std::memory_order_acquire);
+    while (Id(top) != kNone) {
+      auto next = Get(Id(top))->free_next.load(std::memory_order_relaxed);
+      auto popped = std::uint64_t(RefTag(top) + 1) << 32 | next;
+      if (free_.compare_exchange_weak(top, popped, std::memory_order_acq_rel))
+        return Id(top);
+    }
+    return kNone;
+  }
+
+  void PushFree(std::uint32_t id) {
+    auto chunk = Get(id);
+    auto top = free_.load(std::memory_order_relaxed);
+    do {
+      chunk->free_next.store(Id(top), std::memory_order_relaxed);
+    } while (!free_.compare_exchange_weak(
+        top, std::uint64_t(RefTag(top) + 1) << 32 | id,
+        std::memory_order_acq_rel));
+  }
 
-  size_t tail_{0};
-  std::atomic<size_t> num_elements_{0};
+  alignas(64) std::atomic<std::uint64_t> enqueue_pos_{0};
+  alignas(64) std::atomic<std::uint64_t> tail_{0};
+  alignas(64) std::atomic<std::uint64_t> dequeue_pos_{0};
+  alignas(64) std::atomic<std::uint64_t> head_{0};
+  alignas(64) std::atomic<std::uint64_t> free_{kNone};
+  std::atomic<std::uint32_t> next_id_{0};
+  std::array<std::atomic<Chunk*>, kSegments> segments_{};
 };
 
 template <typename T, size_t CHUNK_SIZE = 10>
@@ -2,21 +2,455 @@
 
 #include <tbb/tbb.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "work_stealing_pool.hpp"
+
 namespace tbb_templates {
 
-template <typename T>
-void parallel_for(T& collection, std::function<void(size_t id)> func) {
-  tbb::parallel_for(size_t(0), collection.size(), func);
+enum class Partitioner { kAuto, kSimple, kStatic };
+
+inline constexpr size_t kChunksPerThread{4};
+inline constexpr size_t kDeterministicGrain{64};
+
+template <typename F>
+decltype(auto) with_partitioner(Partitioner partitioner, F&& func) {
+  switch (partitioner) {
+    case Partitioner::kSimple:
+      return func(tbb::simple_partitioner());
+    case Partitioner::kStatic:
+      return func(tbb::static_partitioner());
+    default:
+      return func(tbb::auto_partitioner());
+  }
 }
 
-template <typename T>
-void parallel_for(T enum_start, T enum_end,
-                  std::function<void(size_t id)> func) {
-  tbb::parallel_for(static_cast<size_t>(enum_start),
-                    static_cast<size_t>(enum_end), func);
+template <typename Sig>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  template <typename F>
+    requires(!std::is_same_v<std::remove_cvref_t<F>, FunctionRef>)
+  FunctionRef(F&& func)
+      : object_(const_cast<void*>(
+            static_cast<const void*>(std::addressof(func)))),
+        call_([](void* object, Args... args) -> R {
+          return (*static_cast<std::remove_reference_t<F>*>(object))(
+              std::forward<Args>(args)...);
+        }) {}
+
+  R operator()(Args... args) const {
+    return call_(object_, std::forward<Args>(args)...);
+  }
+
+ private:
+  void* object_;
+  R (*call_)(void*, Args...);
+};
+
+class Executor {
+ public:
+  virtual ~Executor() = default;
+  virtual void ParallelFor(size_t begin, size_t end, size_t grain,
+                           Partitioner partitioner,
+                           FunctionRef<void(size_t, size_t)> body) = 0;
+  virtual size_t Concurrency() const = 0;
+};
+
+class TbbExecutor : public Executor {
+ public:
+  explicit TbbExecutor(int concurrency = tbb::task_arena::automatic)
+      : arena_(concurrency) {}
+
+  void ParallelFor(size_t begin, size_t end, size_t grain,
+                   Partitioner partitioner,
+                   FunctionRef<void(size_t, size_t)> body) override {
+    arena_.execute([&]() {
+      with_partitioner(partitioner, [&](const auto& part) {
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(begin, end, grain),
+            [&](const tbb::blocked_range<size_t>& range) {
+              body(range.begin(), range.end());
+            },
+            part);
+      });
+    });
+  }
+
+  size_t Concurrency() const override { return arena_.max_concurrency(); }
+
+ private:
+  mutable tbb::task_arena arena_;
+};
+
+class PoolExecutor : public Executor {
+ public:
+  explicit PoolExecutor(WorkStealingPool::Options options = {})
+      : pool_(options) {}
+
+  void ParallelFor(size_t begin, size_t end, size_t grain,
+                   Partitioner partitioner,
+                   FunctionRef<void(size_t, size_t)> body) override {
+    if (end <= begin) return;
+    auto size = end - begin;
+    auto concurrency = Concurrency();
+    if (partitioner == Partitioner::kAuto)
+      grain = std::max(grain, size / (concurrency * kChunksPerThread));
+    else if (partitioner == Partitioner::kStatic)
+      grain = std::max(grain, (size + concurrency - 1) / concurrency);
+
+    LoopState state{body, std::max<size_t>(grain, 1), &pool_};
+    auto root = new RangeJob(state, begin, end);
+    if (pool_.OnWorker())
+      root->Execute();
+    else
+      pool_.Spawn(root);
+    pool_.HelpUntil([&]() {
+      return state.pending.load(std::memory_order_acquire) == 0;
+    });
+    if (state.exception) std::rethrow_exception(state.exception);
+  }
+
+  size_t Concurrency() const override {
+    return pool_.Workers() + (pool_.OnWorker() ? 0 : 1);
+  }
+
+ private:
+  struct LoopState {
+    LoopState(FunctionRef<void(size_t, size_t)> body, size_t grain,
+              WorkStealingPool* pool)
+        : body(body), grain(grain), pool(pool) {}
+
+    FunctionRef<void(size_t, size_t)> body;
+    size_t grain;
+    WorkStealingPool* pool;
+    std::atomic<size_t> pending{1};
+    std::atomic<bool> failed{false};
+    std::exception_ptr exception;
+  };
+
+  class RangeJob : public Job {
+   public:
+    RangeJob(LoopState& state, size_t begin, size_t end)
+        : state_(state), begin_(begin), end_(end) {}
+
+    void Execute() override {
+      while (end_ - begin_ > state_.grain) {
+        auto mid = begin_ + (end_ - begin_) / 2;
+        state_.pending.fetch_add(1, std::memory_order_relaxed);
+        state_.pool->Spawn(new RangeJob(state_, mid, end_));
+        end_ = mid;
+      }
+      try {
+        state_.body(begin_, end_);
+      } catch (...) {
+        if (!state_.failed.exchange(true))
+          state_.exception = std::current_exception();
+      }
+      auto& pending = state_.pending;
+      delete this;
+      pending.fetch_sub(1, std::memory_order_release);
+    }
+
+   private:
+    LoopState& state_;
+    size_t begin_;
+    size_t end_;
+  };
+
+  WorkStealingPool pool_;
+};
+
+inline std::atomic<Executor*>& executor_slot() {
+  static std::atomic<Executor*> executor{nullptr};
+  return executor;
+}
+
+inline void set_executor(Executor* executor) {
+  executor_slot().store(executor, std::memory_order_release);
+}
+
+inline Executor* current_executor() {
+  return executor_slot().load(std::memory_order_acquire);
+}
+
+inline size_t concurrency() {
+  if (auto executor = current_executor(); executor)
+    return executor->Concurrency();
+  return tbb::this_task_arena::max_concurrency();
+}
+
+struct TaskKey {
+  std::uint32_t system{0};
+  std::uint64_t sub_key{0};
+  std::uint64_t seq{0};
+
+  auto operator<=>(const TaskKey&) const = default;
+};
+
+inline std::atomic<bool>& deterministic_slot() {
+  static std::atomic<bool> deterministic{false};
+  return deterministic;
+}
+
+inline void set_deterministic(bool deterministic) {
+  deterministic_slot().store(deterministic, std::memory_order_release);
+}
+
+inline bool deterministic() {
+  return deterministic_slot().load(std::memory_order_acquire);
+}
+
+class TaskKeyScope {
+ public:
+  TaskKeyScope(std::uint32_t system, std::uint64_t sub_key)
+      : saved_(Current()) {
+    Current() = {system, sub_key, 0};
+  }
+
+  TaskKeyScope(const TaskKey& parent, std::uint64_t item)
+      : TaskKeyScope(parent.system,
+                     Mix(Mix(parent.sub_key, parent.seq), item)) {}
+
+  ~TaskKeyScope() { Current() = saved_; }
+
+  TaskKeyScope(const TaskKeyScope&) = delete;
+  TaskKeyScope& operator=(const TaskKeyScope&) = delete;
+
+  static TaskKey& Current() {
+    thread_local TaskKey key;
+    return key;
+  }
+
+  static TaskKey Next() {
+    auto& key = Current();
+    return {key.system, key.sub_key, key.seq++};
+  }
+
+ private:
+  static std::uint64_t Mix(std::uint64_t seed, std::uint64_t value) {
+    value += 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return seed ^ value ^ (value >> 31);
+  }
+
+  TaskKey saved_;
+};
+
+template <typename F>
+void dispatch_blocked(size_t begin, size_t end, F&& func, size_t grain,
+                      Partitioner partitioner) {
+  if (auto executor = current_executor(); executor)
+    return executor->ParallelFor(begin, end, grain, partitioner, func);
+  with_partitioner(partitioner, [&](const auto& part) {
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(begin, end, grain),
+        [&](const tbb::blocked_range<size_t>& range) {
+          func(range.begin(), range.end());
+        },
+        part);
+  });
+}
+
+template <typename F>
+void parallel_for_blocked(size_t begin, size_t end, F&& func,
+                          size_t grain = 1,
+                          Partitioner partitioner = Partitioner::kAuto) {
+  if (!deterministic())
+    return dispatch_blocked(begin, end, func, grain, partitioner);
+
+  auto parent = TaskKeyScope::Next();
+  if (end <= begin) return;
+  auto block = std::max(grain, kDeterministicGrain);
+  dispatch_blocked(
+      0, (end - begin + block - 1) / block,
+      [&](size_t first, size_t last) {
+        for (auto b = first; b != last; ++b) {
+          TaskKeyScope scope(parent, b);
+          func(begin + b * block, std::min(end, begin + (b + 1) * block));
+        }
+      },
+      1, partitioner);
+}
+
+template <typename T, typename F>
+  requires std::is_integral_v<T> || std::is_enum_v<T>
+void parallel_for(T enum_start, T enum_end, F&& func, size_t grain = 1,
+                  Partitioner partitioner = Partitioner::kAuto) {
+  parallel_for_blocked(
+      static_cast<size_t>(enum_start), static_cast<size_t>(enum_end),
+      [&](size_t begin, size_t end) {
+        for (auto i = begin; i != end; ++i) func(i);
+      },
+      grain, partitioner);
+}
+
+template <typename T, typename F>
+  requires requires(T& collection) { collection.size(); }
+void parallel_for(T& collection, F&& func, size_t grain = 1,
+                  Partitioner partitioner = Partitioner::kAuto) {
+  parallel_for(size_t(0), size_t(collection.size()), std::forward<F>(func),
+               grain, partitioner);
+}
+
+template <typename V, typename F, typename R>
+V parallel_reduce(size_t begin, size_t end, V identity, F&& func,
+                  R&& reduction, size_t grain = 1,
+                  Partitioner partitioner = Partitioner::kAuto) {
+  if (current_executor() && end > begin) {
+    auto size = end - begin;
+    auto chunks = std::max<size_t>(
+        1, std::min(size / std::max<size_t>(grain, 1),
+                    concurrency() * kChunksPerThread));
+    std::vector<V> partials(chunks, identity);
+    parallel_for_blocked(
+        0, chunks,
+        [&](size_t first, size_t last) {
+          for (auto c = first; c != last; ++c)
+            partials[c] = func(begin + size * c / chunks,
+                               begin + size * (c + 1) / chunks, identity);
+        },
+        1, Partitioner::kSimple);
+    auto result = std::move(partials[0]);
+    for (size_t c = 1; c < chunks; ++c)
+      result = reduction(std::move(result), std::move(partials[c]));
+    return result;
+  }
+  return with_partitioner(partitioner, [&](const auto& part) {
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(begin, end, grain), identity,
+        [&](const tbb::blocked_range<size_t>& range, V init) {
+          return func(range.begin(), range.end(), std::move(init));
+        },
+        reduction, part);
+  });
+}
+
+template <typename V, typename F, typename C>
+V parallel_scan(size_t begin, size_t end, V identity, F&& func, C&& combine,
+                size_t grain = 1) {
+  return tbb::parallel_scan(
+      tbb::blocked_range<size_t>(begin, end, grain), identity,
+      [&](const tbb::blocked_range<size_t>& range, V sum, bool is_final) {
+        return func(range.begin(), range.end(), std::move(sum), is_final);
+      },
+      combine);
+}
+
+template <typename It, typename Compare = std::less<>>
+void parallel_sort(It begin, It end, Compare&& compare = {}) {
+  tbb::parallel_sort(begin, end, std::forward<Compare>(compare));
+}
+
+template <typename... Fs>
+void parallel_invoke(Fs&&... funcs) {
+  if (current_executor() || deterministic()) {
+    FunctionRef<void()> calls[] = {funcs...};
+    auto keyed = deterministic();
+    auto parent = keyed ? TaskKeyScope::Next() : TaskKey{};
+    return dispatch_blocked(
+        0, sizeof...(Fs),
+        [&](size_t first, size_t last) {
+          for (auto i = first; i != last; ++i) {
+            if (keyed) {
+              TaskKeyScope scope(parent, i);
+              calls[i]();
+            } else {
+              calls[i]();
+            }
+          }
+        },
+        1, Partitioner::kSimple);
+  }
+  tbb::parallel_invoke(std::forward<Fs>(funcs)...);
 }
 
 template <typename T>
 using concurrent_vector = tbb::concurrent_vector<T>;
 
+class CostModel {
+ public:
+  static constexpr double kSerialNs{20000};
+  static constexpr double kChunkNs{10000};
+
+  template <typename F>
+  void parallel_for(size_t size, F&& func) {
+    if (size == 0) return;
+    auto ns_per_item = ns_per_item_.load(std::memory_order_relaxed);
+    if (size == 1 || (ns_per_item >= 0 && ns_per_item * size < kSerialNs)) {
+      auto start = Clock::now();
+      if (deterministic()) {
+        auto parent = TaskKeyScope::Next();
+        for (size_t b = 0; b * kDeterministicGrain < size; ++b) {
+          TaskKeyScope scope(parent, b);
+          auto end = std::min(size, (b + 1) * kDeterministicGrain);
+          for (auto i = b * kDeterministicGrain; i != end; ++i) func(i);
+        }
+      } else {
+        for (size_t i = 0; i < size; ++i) func(i);
+      }
+      return Record(size, Elapsed(start));
+    }
+
+    std::atomic<std::int64_t> work_ns{0};
+    auto body = [&](size_t begin, size_t end) {
+      auto start = Clock::now();
+      for (auto i = begin; i != end; ++i) func(i);
+      work_ns.fetch_add(Elapsed(start), std::memory_order_relaxed);
+    };
+    if (ns_per_item < 0 || deterministic())
+      parallel_for_blocked(0, size, body);
+    else
+      parallel_for_blocked(0, size, body, Grain(size), Partitioner::kSimple);
+    Record(size, work_ns.load(std::memory_order_relaxed));
+  }
+
+  bool Serial(size_t size) const {
+    auto ns_per_item = ns_per_item_.load(std::memory_order_relaxed);
+    return size <= 1 || (ns_per_item >= 0 && ns_per_item * size < kSerialNs);
+  }
+
+  size_t Grain(size_t size) const {
+    auto ns_per_item = ns_per_item_.load(std::memory_order_relaxed);
+    auto max_grain =
+        std::max<size_t>(1, size / (kChunksPerThread * concurrency()));
+    if (ns_per_item <= 0) return max_grain;
+    return std::clamp<size_t>(kChunkNs / ns_per_item, 1, max_grain);
+  }
+
+  double NsPerItem() const {
+    return ns_per_item_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static std::int64_t Elapsed(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+        .count();
+  }
+
+  void Record(size_t size, std::int64_t work_ns) {
+    auto sample = double(work_ns) / size;
+    auto old = ns_per_item_.load(std::memory_order_relaxed);
+    ns_per_item_.store(old < 0 ? sample : (old * 3 + sample) / 4,
+                       std::memory_order_relaxed);
+  }
+
+  std::atomic<double> ns_per_item_{-1};
+};
+
 }  // namespace tbb_templates
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef UnixBuild
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tbb_templates {
+class Job {
+ public:
+  virtual ~Job() = default;
+  virtual void Execute() = 0;
+};
+
+template <typename T>
+class ChaseLevDeque {
+  static_assert(std::is_pointer_v<T>);
+
+ public:
+  explicit ChaseLevDeque(size_t capacity = 256)
+      : array_(new Array(capacity)) {}
+  ~ChaseLevDeque() { delete array_.load(std::memory_order_relaxed); }
+
+  void Push(T item) {
+    auto bottom = bottom_.load(std::memory_order_relaxed);
+    auto top = top_.load(std::memory_order_acquire);
+    auto array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > std::int64_t(array->mask))
+      array = Grow(array, bottom, top);
+    array->Put(bottom, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  T Pop() {
+    auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    auto array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = top_.load(std::memory_order_relaxed);
+
+    T item{nullptr};
+    if (top <= bottom) {
+      item = array->Get(bottom);
+      if (top == bottom) {
+        if (!top_.compare_exchange_strong(top, top + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+          item = nullptr;
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+      }
+    } else {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  T Steal() {
+    auto top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) return nullptr;
+
+    auto item = array_.load(std::memory_order_acquire)->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return nullptr;
+    return item;
+  }
+
+  bool Empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Array {
+    explicit Array(size_t capacity)
+        : mask(std::bit_ceil(capacity) - 1),
+          slots(new std::atomic<T>[mask + 1]) {}
+
+    T Get(std::int64_t i) const {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+    void Put(std::int64_t i, T item) {
+      slots[i & mask].store(item, std::memory_order_relaxed);
+    }
+
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+  };
+
+  Array* Grow(Array* array, std::int64_t bottom, std::int64_t top) {
+    auto grown = new Array((array->mask + 1) * 2);
+    for (auto i = top; i < bottom; ++i) grown->Put(i, array->Get(i));
+    retired_.emplace_back(array);
+    array_.store(grown, std::memory_order_release);
+    return grown;
+  }
+
+  alignas(64) std::atomic<std::int64_t> top_{0};
+  alignas(64) std::atomic<std::int64_t> bottom_{0};
+  std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> retired_;
+};
+
+class WorkStealingPool {
+ public:
+  struct Options {
+    size_t workers{std::max(1u, std::thread::hardware_concurrency())};
+    bool pin_threads{false};
+    size_t first_core{0};
+  };
+
+  WorkStealingPool() : WorkStealingPool(Options{}) {}
+
+  explicit WorkStealingPool(Options options) : options_(options) {
+    for (size_t i = 0; i < options_.workers; ++i)
+      workers_.emplace_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < options_.workers; ++i)
+      workers_[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) worker->thread.join();
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  void Spawn(Job* job) {
+    if (current_pool_ == this) {
+      workers_[current_worker_]->deque.Push(job);
+    } else {
+      std::lock_guard lock(mutex_);
+      injected_.push_back(job);
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    if (sleeping_.load(std::memory_order_acquire) > 0) wake_.notify_one();
+  }
+
+  template <typename Pred>
+  void HelpUntil(Pred&& done) {
+    while (!done()) {
+      if (auto job = FindJob(); job)
+        Run(job);
+      else
+        std::this_thread::yield();
+    }
+  }
+
+  size_t Workers() const { return workers_.size(); }
+  bool OnWorker() const { return current_pool_ == this; }
+
+ private:
+  struct Worker {
+    ChaseLevDeque<Job*> deque;
+    std::thread thread;
+  };
+
+  void Run(Job* job) {
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    job->Execute();
+  }
+
+  Job* FindJob() {
+    if (current_pool_ == this)
+      if (auto job = workers_[current_worker_]->deque.Pop(); job) return job;
+
+    auto count = workers_.size();
+    auto start = current_pool_ == this ? current_worker_ + 1 : 0;
+    for (size_t i = 0; i < count; ++i)
+      if (auto job = workers_[(start + i) % count]->deque.Steal(); job)
+        return job;
+
+    std::lock_guard lock(mutex_);
+    if (injected_.empty()) return nullptr;
+    auto job = injected_.front();
+    injected_.pop_front();
+    return job;
+  }
+
+  void Pin(size_t index) {
+#ifdef UnixBuild
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    CPU_SET((options_.first_core + index) % cores, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+  }
+
+  void WorkerLoop(size_t index) {
+    current_pool_ = this;
+    current_worker_ = index;
+    if (options_.pin_threads) Pin(index);
+
+    for (size_t idle = 0;;) {
+      if (auto job = FindJob(); job) {
+        Run(job);
+        idle = 0;
+        continue;
+      }
+      if (++idle < 64) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      std::unique_lock lock(mutex_);
+      if (stop_) return;
+      sleeping_.fetch_add(1, std::memory_order_acq_rel);
+      wake_.wait_for(lock, std::chrono::milliseconds(1), [this]() {
+        return stop_ || queued_.load(std::memory_order_acquire) > 0;
+      });
+      sleeping_.fetch_sub(1, std::memory_order_acq_rel);
+      if (stop_) return;
+      idle = 0;
+    }
+  }
+
+  Options options_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Job*> injected_;
+  std::atomic<std::int64_t> queued_{0};
+  std::atomic<size_t> sleeping_{0};
+  bool stop_{false};
+
+  inline static thread_local WorkStealingPool* current_pool_{nullptr};
+  inline static thread_local size_t current_worker_{0};
+};
+}  // namespace tbb_templates
@@ -0,0 +1,69 @@
+#include "chunk_list.hpp"
+
+TEST(ChunkList, fifo_order_recycles_chunks) {
+  synchronization::ChunkList<int, 4> chunk_list;
+  int value{-1};
+  EXPECT_TRUE(chunk_list.empty());
+  EXPECT_FALSE(chunk_list.try_pop(value));
+
+  size_t chunks{0};
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 10; ++i) chunk_list.push_front(i);
+    EXPECT_EQ(10u, chunk_list.size());
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(chunk_list.try_pop(value));
+      EXPECT_EQ(i, value);
+    }
+    EXPECT_TRUE(chunk_list.empty());
+    EXPECT_FALSE(chunk_list.try_pop(value));
+    if (!round) chunks = chunk_list.chunk_count();
+  }
+  EXPECT_EQ(chunks, chunk_list.chunk_count());
+
+  for (int i = 0; i < 1000; ++i) {
+    chunk_list.push_front(i);
+    chunk_list.push_front(i);
+    ASSERT_TRUE(chunk_list.try_pop(value));
+  }
+  EXPECT_EQ(1000u, chunk_list.size());
+  ASSERT_TRUE(chunk_list.try_pop(value));
+  EXPECT_EQ(500, value);
+}
+
+TEST(ChunkList, concurrent_producers_and_consumers) {
+  constexpr int kThreads{4};
+  constexpr int kItems{20000};
+  synchronization::ChunkList<int, 8> chunk_list;
+  std::atomic<int> popped{0};
+  std::vector<std::vector<int>> seen(kThreads);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&chunk_list, t]() {
+      for (int i = 0; i < kItems; ++i) chunk_list.push_front(t * kItems + i);
+    });
+    threads.emplace_back([&chunk_list, &popped, &seen, t]() {
+      std::vector<int> last(kThreads, -1);
+      int value;
+      while (popped.load() < kThreads * kItems) {
+        if (!chunk_list.try_pop(value)) {
+          std::this_thread::yield();
+          continue;
+        }
+        ++popped;
+        EXPECT_LT(last[value / kItems], value);
+        last[value / kItems] = value;
+        seen[t].emplace_back(value);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::vector<int> all;
+  for (auto& values : seen) all.insert(all.end(), values.begin(), values.end());
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(size_t(kThreads * kItems), all.size());
+  for (int i = 0; i < kThreads * kItems; ++i) EXPECT_EQ(i, all[i]);
+  EXPECT_TRUE(chunk_list.empty());
+  EXPECT_LT(chunk_list.chunk_count(), size_t(kThreads * kItems / 8));
+}
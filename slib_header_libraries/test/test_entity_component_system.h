@@ -2,6 +2,7 @@
 
 #include "entity_manager.h"
 #include "entity_manager_mock.h"
+#include "sharded_entity_manager.h"
 #include "system_manager.h"
 #include "system_manager_mock.h"
 
@@ -53,6 +54,23 @@ class TestSystem {
   std::vector<std::type_index> Dependencies() { return {}; }
 };
 
+inline std::unordered_map<int, std::vector<int>> order_system_deps;
+inline std::atomic<int> order_system_steps{0};
+
+template <int N>
+class OrderSystem {
+ public:
+  void Step(ecs::EntityManager&, SystemManager_t&) { ++order_system_steps; }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() {
+    std::type_index types[] = {typeid(OrderSystem<0>), typeid(OrderSystem<1>),
+                               typeid(OrderSystem<2>), typeid(OrderSystem<3>)};
+    std::vector<std::type_index> deps;
+    for (auto dep : order_system_deps[N]) deps.push_back(types[dep]);
+    return deps;
+  }
+};
+
 class EntityManagerFixture : public Test {
  protected:
   std::any int_obj = int{1};
@@ -117,6 +135,8 @@ TEST_F(EntityManagerFixture, create_entity_and_components) {
   StrictMock<EntityManagerMock> ent_mgr_mock;
   ecs::EntityManager ent_mgr(&ent_mgr_mock);
 
+  ExpectTestSystemInvoke(ent_mgr_mock);
+
   SystemManager_t sys_mgr;
   sys_mgr.AddSystem<TestSystem>();
   sys_mgr.SyncSystems();
@@ -141,3 +161,322 @@ TEST_F(EntityManagerFixture, add_remove_system) {
   EXPECT_EQ(std::any_cast<int>(comps[0]), 2);
   EXPECT_EQ(std::any_cast<int>(int_obj), 3);
 }
+
+TEST(SystemManager, execution_order) {
+  order_system_deps = {{0, {}}, {1, {0}}, {2, {1}}, {3, {0}}};
+  SystemManager_t sys_mgr;
+  sys_mgr.AddSystem<OrderSystem<2>>();
+  sys_mgr.AddSystem<OrderSystem<3>>();
+  sys_mgr.AddSystem<OrderSystem<0>>();
+  sys_mgr.SyncSystems();
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<0>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<2>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<3>>(), 1);
+  EXPECT_FALSE(sys_mgr.ExecutionGroup<OrderSystem<1>>());
+
+  sys_mgr.AddSystem<OrderSystem<1>>();
+  sys_mgr.SyncSystems();
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<1>>(), 1);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<2>>(), 2);
+
+  EntityManager ent_mgr;
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(order_system_steps, 4);
+
+  sys_mgr.RemoveSystem<OrderSystem<0>>();
+  sys_mgr.SyncSystems();
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<1>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<2>>(), 1);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<3>>(), 0);
+
+  order_system_deps[0] = {2};
+  sys_mgr.AddSystem<OrderSystem<0>>();
+  sys_mgr.SyncSystems();
+  ASSERT_EQ(sys_mgr.DependencyCycles().size(), 1);
+  EXPECT_EQ(sys_mgr.DependencyCycles()[0].size(), 3);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<0>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<2>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<3>>(), 1);
+
+  sys_mgr.RemoveSystem<OrderSystem<2>>();
+  sys_mgr.SyncSystems();
+  EXPECT_TRUE(sys_mgr.DependencyCycles().empty());
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<0>>(), 0);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<1>>(), 1);
+  EXPECT_EQ(sys_mgr.ExecutionGroup<OrderSystem<3>>(), 1);
+
+  order_system_steps = 0;
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(order_system_steps, 3);
+}
+
+inline std::atomic<int> budget_steps[3];
+
+template <int N, bool Defer, int Prio, int SleepMs>
+class BudgetSystem {
+ public:
+  void Step(ecs::EntityManager&, SystemManager_t&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(SleepMs));
+    ++budget_steps[N];
+  }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() { return {}; }
+  int Priority() { return Prio; }
+  bool Deferrable() { return Defer; }
+};
+
+TEST(SystemManager, frame_budget_defers_systems) {
+  using Mandatory = BudgetSystem<0, false, 0, 20>;
+  using Expensive = BudgetSystem<1, true, 0, 20>;
+  using Cheap = BudgetSystem<2, true, 1, 0>;
+
+  SystemManager_t sys_mgr;
+  sys_mgr.SetFrameBudget(std::chrono::milliseconds(30), 2);
+  sys_mgr.AddSystem<Mandatory>();
+  sys_mgr.AddSystem<Expensive>();
+  sys_mgr.AddSystem<Cheap>();
+  sys_mgr.SyncSystems();
+
+  EntityManager ent_mgr;
+  for (int frame = 0; frame < 4; ++frame) sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(budget_steps[0], 4);
+  EXPECT_EQ(budget_steps[1], 2);
+  EXPECT_EQ(budget_steps[2], 3);
+  EXPECT_EQ(sys_mgr.DeferredFrames<Expensive>(), 0);
+
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(sys_mgr.DeferredFrames<Expensive>(), 1);
+}
+
+TEST(SystemManager, time_slice_resumes) {
+  SystemManager_t sys_mgr;
+  sys_mgr.SetFrameBudget(std::chrono::nanoseconds(1));
+  EntityManager ent_mgr;
+
+  size_t cursor{0};
+  size_t processed{0};
+  int frames{0};
+  do {
+    sys_mgr.Step(ent_mgr);
+    ++frames;
+  } while (!sys_mgr.TimeSlice(cursor, 200, [&](size_t) { ++processed; }));
+  EXPECT_EQ(frames, 4);
+  EXPECT_EQ(processed, 200);
+  EXPECT_EQ(cursor, 0);
+}
+
+class ShardCountSystem {
+ public:
+  void Step(ecs::EntityManager& ent_mgr, SystemManager_t&) {
+    if (busy_.exchange(true)) overlapped_ = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ++steps_;
+    entities_ += ent_mgr.Entities<int>().size();
+    busy_ = false;
+  }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() { return {}; }
+
+  int steps_{0};
+  size_t entities_{0};
+  bool overlapped_{false};
+  std::atomic<bool> busy_{false};
+};
+
+TEST(SystemManager, step_shards_runs_shards_in_turn) {
+  tbb::global_control workers(tbb::global_control::max_allowed_parallelism, 4);
+  ecs::ShardedEntityManager world(std::vector<tbb::numa_node_id>{-1, -1, -1});
+  for (size_t shard = 0; shard < world.ShardCount(); ++shard) {
+    auto ent = world.CreateEntity(shard);
+    world.Shard(shard).AddComponent<int>(ent) = 1;
+  }
+  world.SyncSwap();
+
+  SystemManager_t sys_mgr;
+  sys_mgr.AddSystem<ShardCountSystem>();
+  sys_mgr.SyncSystems();
+  for (int frame = 0; frame < 2; ++frame) sys_mgr.StepShards(world);
+
+  auto sys = sys_mgr.System<ShardCountSystem>();
+  ASSERT_NE(sys, nullptr);
+  EXPECT_FALSE(sys->overlapped_);
+  EXPECT_EQ(sys->steps_, 6);
+  EXPECT_EQ(sys->entities_, 6);
+}
+
+inline std::vector<int> coroutine_trace;
+
+class CoroutineSystem {
+ public:
+  SystemTask Step(ecs::EntityManager&, SystemManager_t&) {
+    coroutine_trace.push_back(1);
+    co_await NextFrame{};
+    coroutine_trace.push_back(2);
+    coroutine_trace.push_back(co_await Background([]() { return 42; }));
+    co_await SyncPoint{};
+    coroutine_trace.push_back(3);
+  }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() { return {}; }
+};
+
+TEST(SystemManager, coroutine_system_suspends_across_frames) {
+  SystemManager_t sys_mgr;
+  sys_mgr.AddSystem<CoroutineSystem>();
+  sys_mgr.SyncSystems();
+
+  EntityManager ent_mgr;
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(coroutine_trace, std::vector<int>({1}));
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(coroutine_trace, std::vector<int>({1, 2}));
+
+  for (int frame = 0; frame < 1000 && coroutine_trace.size() < 3; ++frame) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sys_mgr.Step(ent_mgr);
+  }
+  EXPECT_EQ(coroutine_trace, std::vector<int>({1, 2, 42}));
+
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(coroutine_trace.size(), 3);
+  sys_mgr.SyncSystems();
+  EXPECT_EQ(coroutine_trace, std::vector<int>({1, 2, 42, 3}));
+
+  sys_mgr.Step(ent_mgr);
+  EXPECT_EQ(coroutine_trace, std::vector<int>({1, 2, 42, 3, 1}));
+}
+
+TEST(SystemManager, offloaded_tasks_apply_at_sync) {
+  tbb::global_control workers(tbb::global_control::max_allowed_parallelism, 2);
+  SystemManager_t sys_mgr;
+  EntityManager ent_mgr;
+  auto target = ent_mgr.CreateEntity();
+  auto doomed = ent_mgr.CreateEntity();
+  ent_mgr.AddComponent<int>(target) = 1;
+  ent_mgr.SyncSwap();
+
+  auto write = sys_mgr.Launch(
+      ent_mgr,
+      [target](CommandBuffer<EntityManager>& commands) {
+        commands.Write<int>(target, 5);
+        commands.Add<double>(target, 2.5);
+      },
+      2);
+  auto dropped = sys_mgr.Launch(
+      ent_mgr, [doomed](CommandBuffer<EntityManager>& commands) {
+        commands.Target(doomed);
+        commands.Add<int>(doomed, 7);
+      });
+  auto cancelled = sys_mgr.Launch(
+      ent_mgr, [target](CommandBuffer<EntityManager>& commands) {
+        commands.Write<int>(target, 9);
+      });
+  cancelled->Cancel();
+  doomed = Entity();
+
+  sys_mgr.Step(ent_mgr);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(target), 1);
+
+  for (int frame = 0; frame < 1000 && write->State() != TaskState::kApplied;
+       ++frame) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sys_mgr.Step(ent_mgr);
+    ent_mgr.SyncSwap();
+  }
+  ASSERT_EQ(write->State(), TaskState::kApplied);
+  EXPECT_EQ(write->applied, 2);
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(target), 5);
+  EXPECT_EQ(*ent_mgr.ComponentR<double>(target), 2.5);
+  EXPECT_EQ(dropped->State(), TaskState::kCancelled);
+  EXPECT_EQ(cancelled->State(), TaskState::kCancelled);
+  EXPECT_EQ(ent_mgr.Entities<int>().size(), 1);
+}
+
+TEST(SystemManager, offloaded_task_errors_rethrow_first) {
+  tbb::global_control workers(tbb::global_control::max_allowed_parallelism, 2);
+  SystemManager_t sys_mgr;
+  EntityManager ent_mgr;
+  std::vector<SystemManager_t::Task> tasks;
+  for (auto message : {"first", "second"})
+    tasks.push_back(sys_mgr.Launch(
+        ent_mgr, [message](CommandBuffer<EntityManager>&) {
+          throw std::runtime_error(message);
+        }));
+  for (auto& task : tasks)
+    while (task->State() == TaskState::kRunning)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  testing::internal::CaptureStderr();
+  std::string error;
+  try {
+    sys_mgr.Step(ent_mgr);
+  } catch (const std::runtime_error& e) {
+    error = e.what();
+  }
+  auto logged = testing::internal::GetCapturedStderr();
+  EXPECT_EQ(error, "first");
+  EXPECT_NE(logged.find("second"), std::string::npos);
+  for (auto& task : tasks) EXPECT_EQ(task->State(), TaskState::kCancelled);
+}
+
+class SpawnSystem {
+ public:
+  void Step(ecs::EntityManager& ent_mgr, SystemManager_t&) {
+    tbb_templates::parallel_for(0, 2000, [&](size_t i) {
+      auto ent = ent_mgr.CreateEntity();
+      ent_mgr.AddComponent<int>(ent) = int(i);
+      if (i % 3 == 0) ent_mgr.AddComponent<double>(ent) = double(i);
+    });
+  }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() { return {}; }
+};
+
+class CullSystem {
+ public:
+  void Step(ecs::EntityManager& ent_mgr, SystemManager_t&) {
+    std::vector<Entity> ents;
+    for (auto& ent : ent_mgr.Entities<int>()) ents.push_back(ent);
+    tbb_templates::parallel_for(ents, [&](size_t i) {
+      if (*ent_mgr.ComponentR<int>(ents[i]) % 7 == 0)
+        ent_mgr.RemoveComponent<int>(ents[i]);
+    });
+  }
+  void Init() {}
+  std::vector<std::type_index> Dependencies() { return {}; }
+};
+
+inline std::vector<int> RunLockstep() {
+  SystemManager_t sys_mgr;
+  EntityManager ent_mgr;
+  sys_mgr.AddSystem<SpawnSystem>();
+  sys_mgr.AddSystem<CullSystem>();
+  sys_mgr.SyncSystems();
+  for (int frame = 0; frame < 3; ++frame) {
+    sys_mgr.Step(ent_mgr);
+    ent_mgr.SyncSwap();
+  }
+
+  std::vector<int> layout;
+  for (auto& ent : ent_mgr.Entities<int>())
+    layout.push_back(*ent_mgr.ComponentR<int>(ent));
+  for (auto& ent : ent_mgr.Entities<double>())
+    layout.push_back(int(*ent_mgr.ComponentR<double>(ent)));
+  return layout;
+}
+
+TEST(SystemManager, deterministic_replay_is_lockstep) {
+  tbb::global_control workers(tbb::global_control::max_allowed_parallelism, 4);
+  tbb_templates::set_deterministic(true);
+  auto tbb_layout = RunLockstep();
+
+  tbb_templates::PoolExecutor pool({.workers = 3});
+  tbb_templates::set_executor(&pool);
+  auto pool_layout = RunLockstep();
+  tbb_templates::set_executor(nullptr);
+  tbb_templates::set_deterministic(false);
+
+  EXPECT_GT(tbb_layout.size(), 2000);
+  EXPECT_EQ(tbb_layout, pool_layout);
+}
@@ -0,0 +1,916 @@
+#include "entity_manager.h"
+#include "sharded_entity_manager.h"
+
+TEST(EntityManager, sort_components) {
+  ecs::EntityManager_t ent_mgr;
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 16; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<int>(ent) = (i * 7) % 16;
+    ent_mgr.AddComponent<double>(ent) = i;
+  }
+  ent_mgr.SyncSwap();
+
+  ent_mgr.SortComponents<int>([](const int& c) { return c; });
+  ent_mgr.SyncSwap();
+
+  int expected{0};
+  for (auto [comp, ent] : ent_mgr.ComponentsR<int>()) {
+    EXPECT_EQ(comp, expected++);
+    EXPECT_EQ(*ent_mgr.ComponentR<int>(ent), comp);
+  }
+
+  ent_mgr.MatchOrder<double, int>();
+  ent_mgr.SyncSwap();
+
+  auto ints = ent_mgr.ComponentsR<int>();
+  auto doubles = ent_mgr.ComponentsR<double>();
+  ASSERT_EQ(ints.size(), doubles.size());
+  for (size_t i = 0; i < ints.size(); ++i) {
+    auto [d, ent] = doubles[i];
+    EXPECT_EQ(ent, std::get<1>(ints[i]));
+    EXPECT_EQ(*ent_mgr.ComponentR<double>(ent), d);
+  }
+}
+
+struct Particle {
+  float x{0}, y{0}, z{0};
+  float vx{0}, vy{0}, vz{0};
+};
+
+template <>
+struct ecs::SoaLayout<Particle> {
+  static constexpr auto fields =
+      std::make_tuple(&Particle::x, &Particle::y, &Particle::z, &Particle::vx,
+                      &Particle::vy, &Particle::vz);
+};
+
+TEST(EntityManager, soa_components) {
+  ecs::EntityManager_t ent_mgr;
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 21; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<Particle>(ent) = Particle{.x = float(i), .vx = 1};
+  }
+  ent_mgr.RemoveComponent<Particle>(ents[3]);
+  ent_mgr.SyncSwap();
+  ent_mgr.SyncSwap();
+
+  auto particles = ent_mgr.ColumnsW<Particle>();
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(particles.column<0>()) % 64, 0);
+  for (auto chunk : particles.Chunks<8>()) {
+    auto x = chunk.column<0>();
+    auto vx = chunk.column<3>();
+    for (size_t i = 0; i < chunk.size(); ++i) x[i] += vx[i];
+  }
+  ent_mgr.SyncSwap();
+
+  auto moved = ent_mgr.ColumnsR<Particle>();
+  EXPECT_EQ(moved.size(), 20);
+  for (auto [particle, ent] : moved) {
+    Particle p = particle;
+    EXPECT_EQ(p.x, float(std::find(ents.begin(), ents.end(), ent) -
+                         ents.begin() + 1));
+    EXPECT_EQ(particle.get<3>(), 1.f);
+  }
+}
+
+TEST(EntityManager, soa_copy_back_written_columns) {
+  for (auto async : {false, true}) {
+    ecs::EntityManager_t ent_mgr;
+    ent_mgr.SetAsyncCopyBack(async);
+
+    std::vector<ecs::Entity_t> ents;
+    for (int i = 0; i < 16; ++i) {
+      auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+      ent_mgr.AddComponent<Particle>(ent) = Particle{.x = float(i)};
+    }
+    ent_mgr.SyncSwap();
+    ent_mgr.SyncSwap();
+
+    auto particles = ent_mgr.ColumnsW<Particle>();
+    auto x = particles.column<0>();
+    auto y = particles.components->column<1>();
+    for (size_t i = 0; i < particles.size(); ++i) {
+      x[i] += 1;
+      y[i] = -1;
+    }
+    ent_mgr.SyncSwap();
+    EXPECT_EQ(ent_mgr.StoreStatistics<Particle>().updated, 0);
+
+    auto copied = ent_mgr.ColumnsW<Particle>();
+    for (size_t i = 0; i < copied.size(); ++i) {
+      auto ent = std::get<1>(copied[i]);
+      EXPECT_EQ(copied.column<0>()[i],
+                float(std::find(ents.begin(), ents.end(), ent) -
+                      ents.begin() + 1));
+      EXPECT_EQ(copied.components->column<1>()[i], 0.f);
+    }
+  }
+}
+
+TEST(EntityManager, command_buffer_removes_soa_components) {
+  ecs::EntityManager_t ent_mgr;
+  auto ent = ent_mgr.CreateEntity();
+  ent_mgr.AddComponent<Particle>(ent) = Particle{.x = 1};
+  ent_mgr.SyncSwap();
+
+  ecs::CommandBuffer<ecs::EntityManager_t> commands;
+  commands.Remove<Particle>(ent);
+  commands.Remove<int>(ent);
+  EXPECT_EQ(commands.Apply(ent_mgr), 1);
+  ent_mgr.SyncSwap();
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.ComponentCount<Particle>(ent), 0);
+  EXPECT_EQ(ent_mgr.ColumnsR<Particle>().size(), 0);
+}
+
+struct Selected {};
+struct Dead {};
+
+TEST(EntityManager, tag_components) {
+  ecs::EntityManager_t ent_mgr;
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 200; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<int>(ent) = i;
+    if (i % 2 == 0) ent_mgr.AddComponent<Selected>(ent);
+    if (i % 3 == 0) ent_mgr.AddComponent<Dead>(ent);
+  }
+  ent_mgr.SyncSwap();
+
+  EXPECT_NE(ent_mgr.ComponentR<Selected>(ents[2]), nullptr);
+  EXPECT_EQ(ent_mgr.ComponentR<Selected>(ents[1]), nullptr);
+  EXPECT_EQ(ent_mgr.ComponentCount<Dead>(ents[3]), 1);
+  EXPECT_EQ(ent_mgr.TagsR<Selected>().Count(), 100);
+
+  size_t count{0};
+  const auto& dead = ent_mgr.TagsR<Dead>();
+  for (auto& ent : ent_mgr.TagFilter<Selected>().Without(dead)) {
+    auto value = *ent_mgr.ComponentR<int>(ent);
+    EXPECT_TRUE(value % 2 == 0 && value % 3 != 0);
+    ++count;
+  }
+  EXPECT_EQ(count, 66);
+
+  ent_mgr.RemoveComponent<Selected>(ents[4]);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.ComponentR<Selected>(ents[4]), nullptr);
+  EXPECT_EQ((ent_mgr.TagFilter<Selected, Dead>().size()), 34);
+
+  size_t tag_slots{0};
+  for (int frame = 0; frame < 10; ++frame) {
+    std::vector<ecs::Entity_t> churn;
+    for (int i = 0; i < 64; ++i) {
+      auto& ent = churn.emplace_back(ent_mgr.CreateEntity());
+      ent_mgr.AddComponent<Selected>(ent);
+    }
+    ent_mgr.SyncSwap();
+    for (auto& ent : churn) ent_mgr.RemoveComponent<Selected>(ent);
+    ent_mgr.SyncSwap();
+    if (frame == 0) tag_slots = ent_mgr.SyncStatistics().tag_slots;
+  }
+  EXPECT_EQ(ent_mgr.SyncStatistics().tag_slots, tag_slots);
+  EXPECT_EQ((ent_mgr.TagFilter<Selected, Dead>().size()), 34);
+  EXPECT_EQ(ent_mgr.TagsR<Selected>().Count(), 99);
+}
+
+TEST(EntityManager, resources) {
+  ecs::EntityManager_t ent_mgr;
+
+  ent_mgr.AddComponent<int>() = 1;
+  ent_mgr.AddComponent<float>(ecs::Buffering::kSingle) = 1.f;
+  EXPECT_EQ(ent_mgr.ComponentR<int>(), nullptr);
+  ent_mgr.SyncSwap();
+
+  *ent_mgr.ComponentW<int>() = 2;
+  *ent_mgr.ComponentW<float>() = 2.f;
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(), 1);
+  EXPECT_EQ(*ent_mgr.ComponentR<float>(), 2.f);
+  ent_mgr.SyncSwap();
+
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(), 2);
+  EXPECT_EQ(*ent_mgr.ComponentW<int>(), 2);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(*ent_mgr.ComponentW<int>(), 2);
+
+  ent_mgr.AddComponent<int>(ecs::Buffering::kSingle) = 3;
+  ent_mgr.AddComponent<float>() = 3.f;
+  ent_mgr.SyncSwap();
+  *ent_mgr.ComponentW<int>() = 4;
+  *ent_mgr.ComponentW<float>() = 4.f;
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(), 4);
+  EXPECT_EQ(*ent_mgr.ComponentR<float>(), 3.f);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(*ent_mgr.ComponentR<float>(), 4.f);
+
+  ent_mgr.RemoveComponent<int>();
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.ComponentR<int>(), nullptr);
+}
+
+struct Material {
+  std::string name;
+  bool operator==(const Material& other) const { return name == other.name; }
+};
+
+template <>
+struct std::hash<Material> {
+  size_t operator()(const Material& m) const {
+    return std::hash<std::string>{}(m.name);
+  }
+};
+
+TEST(EntityManager, shared_components) {
+  ecs::EntityManager_t ent_mgr;
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 9; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddSharedComponent<Material>(ent, {i % 3 ? "stone" : "wood"});
+  }
+  ent_mgr.SyncSwap();
+
+  EXPECT_EQ(ent_mgr.SharedComponentR<Material>(ents[0]),
+            ent_mgr.SharedComponentR<Material>(ents[3]));
+  EXPECT_EQ(ent_mgr.SharedComponentR<Material>(ents[1])->name, "stone");
+  EXPECT_EQ(ent_mgr.SharedComponentsR<Material>().size(), 2);
+
+  for (auto [material, group] : ent_mgr.SharedComponentsR<Material>()) {
+    EXPECT_EQ(group.size(), material.name == "wood" ? 3 : 6);
+    for (auto& ent : group)
+      EXPECT_EQ(ent_mgr.SharedComponentR<Material>(ent)->name, material.name);
+  }
+
+  for (int i = 0; i < 9; i += 3)
+    ent_mgr.RemoveSharedComponent<Material>(ents[i]);
+  ent_mgr.AddSharedComponent<Material>(ents[1], {"glass"});
+  ent_mgr.SyncSwap();
+
+  EXPECT_EQ(ent_mgr.SharedComponentR<Material>(ents[0]), nullptr);
+  EXPECT_EQ(ent_mgr.SharedComponentR<Material>(ents[1])->name, "glass");
+  EXPECT_EQ(ent_mgr.SharedComponentsR<Material>().size(), 2);
+  for (auto [material, group] : ent_mgr.SharedComponentsR<Material>())
+    EXPECT_EQ(group.size(), material.name == "glass" ? 1 : 5);
+}
+
+struct Position {
+  float x{0}, y{0}, z{0};
+};
+
+TEST(EntityManager, spatial_index) {
+  ecs::EntityManager_t ent_mgr;
+  ent_mgr.AddSpatialIndex<Position>(2.f, [](const Position& p) {
+    return std::array<float, 3>{p.x, p.y, p.z};
+  });
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 10; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<Position>(ent) = Position{float(i), 0, 0};
+  }
+  ent_mgr.SyncSwap();
+
+  auto index = ent_mgr.SpatialIndexR<Position>();
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(index->size(), 10);
+  EXPECT_EQ(index->QueryRadius({0, 0, 0}, 2.5f).size(), 3);
+  EXPECT_EQ(index->QueryBox({3.5f, -1, -1}, {6.5f, 1, 1}).size(), 3);
+
+  ent_mgr.ComponentW<Position>(ents[9])->x = 0.5f;
+  ent_mgr.RemoveComponent<Position>(ents[0]);
+  ent_mgr.SyncSwap();
+
+  auto near = index->QueryRadius({0, 0, 0}, 1.f);
+  ASSERT_EQ(near.size(), 2);
+  EXPECT_TRUE(std::find(near.begin(), near.end(), ents[9]) != near.end());
+  EXPECT_TRUE(std::find(near.begin(), near.end(), ents[0]) == near.end());
+
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(index->size(), 9);
+  EXPECT_EQ(index->QueryRadius({9, 0, 0}, 1.f).size(), 1);
+
+  auto hooks = ent_mgr.SyncStatistics().sync_hooks;
+  ent_mgr.AddSpatialIndex<Position>(4.f, [](const Position& p) {
+    return std::array<float, 3>{p.x, 0, 0};
+  });
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.SyncStatistics().sync_hooks, hooks);
+  ent_mgr.ComponentW<Position>(ents[5])->x = 20.f;
+  ent_mgr.SyncSwap();
+  index = ent_mgr.SpatialIndexR<Position>();
+  EXPECT_EQ(index->size(), 9);
+  EXPECT_EQ(index->QueryRadius({20, 0, 0}, 1.f).size(), 1);
+}
+
+struct NetworkId {
+  std::uint64_t id{0};
+  int team{0};
+};
+
+TEST(EntityManager, value_index) {
+  ecs::EntityManager_t ent_mgr;
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 100; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<NetworkId>(ent) =
+        NetworkId{std::uint64_t(1000 + i), i % 4};
+  }
+  ent_mgr.SyncSwap();
+
+  ent_mgr.AddValueIndex<NetworkId>([](const NetworkId& n) { return n.id; });
+  ent_mgr.SyncSwap();
+
+  for (int i = 0; i < 100; ++i) {
+    auto ent = ent_mgr.FindEntity<NetworkId>(std::uint64_t(1000 + i));
+    ASSERT_NE(ent, nullptr);
+    EXPECT_EQ(*ent, ents[i]);
+  }
+  EXPECT_EQ(ent_mgr.FindEntity<NetworkId>(std::uint64_t(5)), nullptr);
+
+  ent_mgr.ComponentW<NetworkId>(ents[3])->id = 5;
+  ent_mgr.ComponentW<NetworkId>(ents[4])->id = 1010;
+  ent_mgr.RemoveComponent<NetworkId>(ents[7]);
+  ent_mgr.SyncSwap();
+
+  auto index = ent_mgr.ValueIndexR<NetworkId, std::uint64_t>();
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(*ent_mgr.FindEntity<NetworkId>(std::uint64_t(5)), ents[3]);
+  EXPECT_EQ(ent_mgr.FindEntity<NetworkId>(std::uint64_t(1003)), nullptr);
+  EXPECT_EQ(ent_mgr.FindEntity<NetworkId>(std::uint64_t(1007)), nullptr);
+  EXPECT_EQ(*ent_mgr.FindEntity<NetworkId>(std::uint64_t(1010)), ents[10]);
+  ASSERT_EQ(index->Conflicts().size(), 1);
+  EXPECT_EQ(index->Conflicts()[0], ents[4]);
+  EXPECT_EQ(index->size(), 98);
+
+  ecs::EntityManager_t team_mgr;
+  for (auto i = 0; i < 100; ++i) {
+    auto ent = team_mgr.CreateEntity();
+    team_mgr.AddComponent<NetworkId>(ent) = NetworkId{std::uint64_t(i), i % 4};
+  }
+  team_mgr.AddValueIndex<NetworkId>([](const NetworkId& n) { return n.team; },
+                                    ecs::IndexKind::kMulti);
+  team_mgr.SyncSwap();
+  for (int team = 0; team < 4; ++team)
+    EXPECT_EQ(team_mgr.FindEntities<NetworkId>(team).size(), 25);
+
+  auto hooks = team_mgr.SyncStatistics().sync_hooks;
+  team_mgr.AddValueIndex<NetworkId>(
+      [](const NetworkId& n) { return n.team % 2; }, ecs::IndexKind::kMulti);
+  team_mgr.SyncSwap();
+  EXPECT_EQ(team_mgr.SyncStatistics().sync_hooks, hooks);
+  EXPECT_EQ(team_mgr.FindEntities<NetworkId>(1).size(), 50);
+}
+
+struct Damage {
+  int target{0};
+  int amount{0};
+};
+
+TEST(EntityManager, event_channels) {
+  ecs::EntityManager_t ent_mgr;
+  EXPECT_TRUE(ent_mgr.EventsR<Damage>().empty());
+
+  tbb::parallel_for(0, 1000, [&](int i) {
+    ent_mgr.SendEvent<Damage>(Damage{i, 1});
+  });
+  EXPECT_TRUE(ent_mgr.EventsR<Damage>().empty());
+  ent_mgr.SyncSwap();
+
+  auto events = ent_mgr.EventsR<Damage>();
+  EXPECT_EQ(events.size(), 1000);
+  std::vector<int> targets;
+  for (auto& event : events) targets.push_back(event.target);
+  std::sort(std::begin(targets), std::end(targets));
+  for (int i = 0; i < 1000; ++i) EXPECT_EQ(targets[i], i);
+
+  ent_mgr.SendEvent<Damage>(Damage{7, 2});
+  EXPECT_EQ(ent_mgr.EventsR<Damage>().size(), 1000);
+  ent_mgr.SyncSwap();
+
+  events = ent_mgr.EventsR<Damage>();
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ((*events.begin()).amount, 2);
+
+  ent_mgr.SyncSwap();
+  EXPECT_TRUE(ent_mgr.EventsR<Damage>().empty());
+}
+
+struct RigidBody {
+  float mass{1};
+};
+
+TEST(EntityManager, observers) {
+  ecs::EntityManager_t ent_mgr;
+  size_t added{0}, updated{0}, removed{0}, added_calls{0};
+  float mass_sum{0};
+  ent_mgr.OnAdded<RigidBody>([&](std::span<const ecs::Entity_t> ents,
+                                 std::span<const RigidBody> bodies) {
+    EXPECT_EQ(ents.size(), bodies.size());
+    ++added_calls;
+    added += ents.size();
+    for (auto& body : bodies) mass_sum += body.mass;
+  });
+  ent_mgr.OnUpdated<RigidBody>(
+      [&](std::span<const ecs::Entity_t> ents,
+          std::span<const RigidBody>) { updated += ents.size(); });
+  ent_mgr.OnRemoved<RigidBody>(
+      [&](std::span<const ecs::Entity_t> ents,
+          std::span<const RigidBody>) { removed += ents.size(); });
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 10; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<RigidBody>(ent).mass = 2.f;
+  }
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(added_calls, 1);
+  EXPECT_EQ(added, 10);
+  EXPECT_FLOAT_EQ(mass_sum, 20.f);
+
+  ent_mgr.ComponentW<RigidBody>(ents[2])->mass = 3.f;
+  ent_mgr.ComponentW<RigidBody>(ents[5])->mass = 3.f;
+  ent_mgr.RemoveComponent<RigidBody>(ents[0]);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(updated, 10);
+  EXPECT_EQ(removed, 1);
+
+  ent_mgr.SyncSwap();
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(added_calls, 1);
+  EXPECT_EQ(updated, 10);
+  EXPECT_EQ(removed, 1);
+}
+
+TEST(EntityManager, prefab_instantiate) {
+  ecs::EntityManager_t ent_mgr;
+  auto existing = ent_mgr.CreateEntity();
+  ent_mgr.AddComponent<RigidBody>(existing).mass = 9.f;
+  ent_mgr.SyncSwap();
+
+  ecs::Prefab enemy;
+  enemy.Add(RigidBody{5.f})
+      .Add(Position{1, 2, 3})
+      .Add(Selected{})
+      .Override<Position>([](size_t i, Position& pos) { pos.x = float(i); });
+
+  auto ents = ent_mgr.Instantiate(enemy, 1000);
+  ASSERT_EQ(ents.size(), 1000);
+  ent_mgr.SyncSwap();
+
+  EXPECT_EQ(ent_mgr.ComponentsR<RigidBody>().size(), 1001);
+  EXPECT_EQ(ent_mgr.ComponentsR<Position>().size(), 1000);
+  EXPECT_EQ(ent_mgr.TagsR<Selected>().Count(), 1000);
+  EXPECT_EQ(ent_mgr.AddedComponentsR<Position>().size(), 1000);
+  for (size_t i = 0; i < ents.size(); ++i) {
+    EXPECT_FLOAT_EQ(ent_mgr.ComponentR<RigidBody>(ents[i])->mass, 5.f);
+    EXPECT_FLOAT_EQ(ent_mgr.ComponentR<Position>(ents[i])->x, float(i));
+    EXPECT_FLOAT_EQ(ent_mgr.ComponentW<Position>(ents[i])->y, 2.f);
+  }
+  EXPECT_FLOAT_EQ(ent_mgr.ComponentR<RigidBody>(existing)->mass, 9.f);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.UpdatedComponentsR<RigidBody>().size(), 1000);
+
+  ent_mgr.RemoveComponent<Position>(ents[0]);
+  ent_mgr.SyncSwap();
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.ComponentsR<Position>().size(), 999);
+  EXPECT_FLOAT_EQ(ent_mgr.ComponentR<Position>(ents[999])->x, 999.f);
+}
+
+TEST(EntityManager, stable_compact_removal) {
+  ecs::EntityManager_t ent_mgr;
+  ent_mgr.SetRemovalPolicy<int>(ecs::RemovalPolicy::kStableCompact);
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 20000; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<int>(ent) = i;
+  }
+  ent_mgr.AddComponent<int>(ents[10]) = -1;
+  ent_mgr.SyncSwap();
+
+  for (int i = 0; i < 20000; i += 3) ent_mgr.RemoveComponent<int>(ents[i]);
+  ent_mgr.RemoveComponent<int>(ents[10], 1);
+  ent_mgr.SyncSwap();
+  ent_mgr.SyncSwap();
+
+  auto comps = ent_mgr.ComponentsR<int>();
+  EXPECT_EQ(comps.size(), 20000 - 6667);
+  int prev = -1;
+  for (auto [value, ent] : comps) {
+    EXPECT_GT(value, prev);
+    EXPECT_NE(value % 3, 0);
+    prev = value;
+  }
+  for (int i = 0; i < 20000; ++i) {
+    auto value = ent_mgr.ComponentR<int>(ents[i]);
+    if (i % 3 == 0) {
+      EXPECT_EQ(value, nullptr);
+    } else {
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(*value, i);
+    }
+  }
+  EXPECT_EQ(ent_mgr.ComponentCount<int>(ents[10]), 1);
+}
+
+TEST(EntityManager, access_stats_and_hot_cold) {
+  ecs::EntityManager_t ent_mgr;
+  ent_mgr.SetHotColdPolicy<Position>(ecs::HotColdPolicy{2, 4});
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 1000; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<Position>(ent) = Position{float(i), 0, 0};
+  }
+  ent_mgr.SyncSwap();
+
+  for (int i = 0; i < 5; ++i) ent_mgr.ComponentR<Position>(ents[i]);
+  for (int i = 0; i < 3; ++i) ent_mgr.ComponentW<Position>(ents[i]);
+  ent_mgr.SyncSwap();
+  auto stats = ent_mgr.AccessStats<Position>();
+  EXPECT_EQ(stats.reads, 5);
+  EXPECT_EQ(stats.writes, 3);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.AccessStats<Position>().reads, 0);
+
+  ent_mgr.AddComponent<int>(ents[0]) = 0;
+  ent_mgr.SyncSwap();
+  ent_mgr.ComponentR<int>(ents[0]);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.AccessStats<int>().reads, 0);
+  ent_mgr.TrackAccess<int>();
+  ent_mgr.SyncSwap();
+  ent_mgr.ComponentR<int>(ents[0]);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.AccessStats<int>().reads, 1);
+
+  for (int frame = 0; frame < 8; ++frame) {
+    for (int i = 0; i < 1000; i += 100)
+      ent_mgr.ComponentW<Position>(ents[i])->y = float(frame);
+    ent_mgr.SyncSwap();
+  }
+
+  auto hot = ent_mgr.HotComponentsR<Position>();
+  ASSERT_EQ(hot.size(), 10);
+  for (auto [pos, ent] : hot) EXPECT_EQ(int(pos.x) % 100, 0);
+  EXPECT_EQ(ent_mgr.ComponentsR<Position>().size(), 1000);
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_FLOAT_EQ(ent_mgr.ComponentR<Position>(ents[i])->x, float(i));
+}
+
+TEST(EntityManager, sharded_migration) {
+  ecs::ShardedEntityManager world(std::vector<tbb::numa_node_id>{-1, -1});
+  ASSERT_EQ(world.ShardCount(), 2);
+  auto& shard0 = world.Shard(0);
+  auto& shard1 = world.Shard(1);
+
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 100; ++i) {
+    auto& ent = ents.emplace_back(world.CreateEntity(0));
+    shard0.AddComponent<int>(ent) = i;
+    shard0.AddComponent<Position>(ent) = Position{float(i), 0, 0};
+    if (i % 2 == 0) shard0.AddComponent<Selected>(ent);
+    shard0.AddSharedComponent<Material>(ent, Material{std::to_string(i % 3)});
+  }
+  world.SyncSwap();
+
+  for (int i = 0; i < 100; i += 2) world.Migrate(ents[i], 0, 1);
+  shard0.RemoveComponent<int>(ents[4]);
+  world.SyncSwap();
+
+  EXPECT_EQ(shard0.ComponentsR<Position>().size(), 51);
+  EXPECT_EQ(shard1.ComponentsR<Position>().size(), 49);
+  EXPECT_EQ(shard0.TagsR<Selected>().Count(), 1);
+  EXPECT_EQ(shard1.TagsR<Selected>().Count(), 49);
+  for (int i = 0; i < 100; ++i) {
+    auto& owner = (i % 2 == 0 && i != 4) ? shard1 : shard0;
+    ASSERT_NE(owner.ComponentR<int>(ents[i]), nullptr);
+    EXPECT_EQ(*owner.ComponentR<int>(ents[i]), i);
+    EXPECT_FLOAT_EQ(owner.ComponentW<Position>(ents[i])->x, float(i));
+    EXPECT_EQ(owner.SharedComponentR<Material>(ents[i])->name,
+              std::to_string(i % 3));
+    EXPECT_EQ(owner.ComponentR<Selected>(ents[i]) != nullptr, i % 2 == 0);
+  }
+
+  world.SyncSwap();
+  EXPECT_EQ(shard1.ComponentsR<Position>().size(), 50);
+  EXPECT_EQ(shard1.ComponentR<int>(ents[4]), nullptr);
+  EXPECT_FLOAT_EQ(shard1.ComponentR<Position>(ents[4])->x, 4.f);
+
+  std::atomic<int> visited{0};
+  world.ForEachShard([&](size_t, ecs::EntityManager_t& ent_mgr) {
+    visited += ent_mgr.ComponentsR<Position>().size();
+  });
+  EXPECT_EQ(visited, 100);
+}
+
+TEST(EntityManager, sharded_migration_detaches_indexes) {
+  ecs::ShardedEntityManager world(std::vector<tbb::numa_node_id>{-1, -1});
+  size_t removed{0};
+  std::vector<size_t> added(world.ShardCount(), 0);
+  for (size_t shard = 0; shard < world.ShardCount(); ++shard) {
+    auto& ent_mgr = world.Shard(shard);
+    ent_mgr.AddSpatialIndex<Position>(2.f, [](const Position& p) {
+      return std::array<float, 3>{p.x, p.y, p.z};
+    });
+    ent_mgr.AddValueIndex<NetworkId>([](const NetworkId& n) { return n.id; });
+    ent_mgr.OnRemoved<NetworkId>(
+        [&](std::span<const ecs::Entity_t> ents,
+            std::span<const NetworkId>) { removed += ents.size(); });
+    ent_mgr.OnAdded<NetworkId>([&, shard](std::span<const ecs::Entity_t> ents,
+                                          std::span<const NetworkId>) {
+      added[shard] += ents.size();
+    });
+  }
+
+  auto& shard0 = world.Shard(0);
+  auto& shard1 = world.Shard(1);
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 10; ++i) {
+    auto& ent = ents.emplace_back(world.CreateEntity(0));
+    shard0.AddComponent<Position>(ent) = Position{float(i), 0, 0};
+    shard0.AddComponent<NetworkId>(ent) = NetworkId{std::uint64_t(i), 0};
+  }
+  world.SyncSwap();
+  EXPECT_EQ(shard0.SpatialIndexR<Position>()->size(), 10);
+
+  for (int i = 0; i < 10; i += 2) world.Migrate(ents[i], 0, 1);
+  world.SyncSwap();
+  world.SyncSwap();
+
+  EXPECT_EQ(removed, 5);
+  EXPECT_EQ(added[0], 10);
+  EXPECT_EQ(added[1], 5);
+  EXPECT_EQ(shard0.SpatialIndexR<Position>()->size(), 5);
+  EXPECT_EQ(shard1.SpatialIndexR<Position>()->size(), 5);
+  EXPECT_EQ((shard0.ValueIndexR<NetworkId, std::uint64_t>()->size()), 5);
+  EXPECT_EQ((shard1.ValueIndexR<NetworkId, std::uint64_t>()->size()), 5);
+  for (int i = 0; i < 10; ++i) {
+    auto& owner = i % 2 == 0 ? shard1 : shard0;
+    auto& other = i % 2 == 0 ? shard0 : shard1;
+    auto near = other.SpatialIndexR<Position>()->QueryRadius(
+        {float(i), 0, 0}, 0.1f);
+    EXPECT_TRUE(near.empty());
+    near = owner.SpatialIndexR<Position>()->QueryRadius({float(i), 0, 0}, 0.1f);
+    ASSERT_EQ(near.size(), 1);
+    EXPECT_EQ(near[0], ents[i]);
+    EXPECT_EQ(other.FindEntity<NetworkId>(std::uint64_t(i)), nullptr);
+    ASSERT_NE(owner.FindEntity<NetworkId>(std::uint64_t(i)), nullptr);
+    EXPECT_EQ(*owner.FindEntity<NetworkId>(std::uint64_t(i)), ents[i]);
+  }
+}
+
+TEST(EntityManager, async_copy_back) {
+  ecs::EntityManager_t sync_mgr;
+  ecs::EntityManager_t async_mgr;
+  async_mgr.SetAsyncCopyBack(true);
+
+  std::vector<ecs::Entity_t> sync_ents, async_ents;
+  for (int i = 0; i < 500; ++i) {
+    auto& sync_ent = sync_ents.emplace_back(sync_mgr.CreateEntity());
+    auto& async_ent = async_ents.emplace_back(async_mgr.CreateEntity());
+    sync_mgr.AddComponent<int>(sync_ent) = i;
+    async_mgr.AddComponent<int>(async_ent) = i;
+  }
+  sync_mgr.SyncSwap();
+  async_mgr.SyncSwap();
+
+  for (int frame = 0; frame < 10; ++frame) {
+    tbb::parallel_for(0, 500, [&](int i) {
+      if ((i + frame) % 3 != 0 || i == 4) return;
+      *sync_mgr.ComponentW<int>(sync_ents[i]) += frame;
+      *async_mgr.ComponentW<int>(async_ents[i]) += frame;
+    });
+    if (frame == 4) {
+      sync_mgr.RemoveComponent<int>(sync_ents[frame]);
+      async_mgr.RemoveComponent<int>(async_ents[frame]);
+    }
+    sync_mgr.SyncSwap();
+    async_mgr.SyncSwap();
+    EXPECT_EQ(async_mgr.StoreStatistics<int>().updated,
+              sync_mgr.StoreStatistics<int>().updated);
+
+    for (int i = 0; i < 500; ++i) {
+      auto sync_value = sync_mgr.ComponentR<int>(sync_ents[i]);
+      auto async_value = async_mgr.ComponentR<int>(async_ents[i]);
+      ASSERT_EQ(sync_value == nullptr, async_value == nullptr);
+      if (sync_value) {
+        EXPECT_EQ(*sync_value, *async_value);
+      }
+    }
+  }
+}
+
+TEST(EntityManager, store_statistics) {
+  struct Marker {};
+  ecs::EntityManager_t ent_mgr;
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 100; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<int>(ent) = i;
+    if (i % 2 == 0) ent_mgr.AddComponent<Marker>(ent);
+  }
+
+  auto sync_stats = ent_mgr.SyncStatistics();
+  EXPECT_EQ(sync_stats.pending_adds, 100);
+  EXPECT_EQ(sync_stats.pending_tags, 50);
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(ent_mgr.StoreStatistics<int>().added, 100);
+  ent_mgr.SyncSwap();
+
+  for (int i = 0; i < 10; ++i) *ent_mgr.ComponentW<int>(ents[i]) += 1;
+  ent_mgr.RemoveComponent<int>(ents[99]);
+  EXPECT_EQ(ent_mgr.SyncStatistics().pending_removes, 1);
+
+  auto stats = ent_mgr.StoreStatistics<int>();
+  EXPECT_EQ(stats.type, std::type_index(typeid(int)));
+  EXPECT_EQ(stats.count, 100);
+  EXPECT_EQ(stats.dirty, 10);
+  EXPECT_GE(stats.capacity, 100);
+  EXPECT_GE(stats.bytes, 2 * 100 * sizeof(int) + 100 * sizeof(Entity));
+
+  ent_mgr.SyncSwap();
+  stats = ent_mgr.StoreStatistics<int>();
+  EXPECT_EQ(stats.updated, 10);
+  EXPECT_EQ(stats.removed, 1);
+  EXPECT_GT(ent_mgr.SyncStatistics().sync_time.count(), 0);
+
+  auto all = ent_mgr.StoreStatistics();
+  ASSERT_EQ(all.size(), 2);
+  for (auto& store : all) {
+    if (store.type == typeid(Marker)) {
+      EXPECT_EQ(store.count, 50);
+    }
+  }
+  EXPECT_EQ(ent_mgr.StoreStatistics<float>().count, 0);
+}
+
+TEST(CostModel, adapts_to_recorded_cost) {
+  tbb_templates::CostModel cost;
+  EXPECT_LT(cost.NsPerItem(), 0);
+  EXPECT_FALSE(cost.Serial(100));
+
+  std::vector<int> visits(100, 0);
+  cost.parallel_for(visits.size(), [&](size_t i) { ++visits[i]; });
+  EXPECT_EQ(std::count(visits.begin(), visits.end(), 1), 100);
+  EXPECT_GE(cost.NsPerItem(), 0);
+  EXPECT_TRUE(cost.Serial(100));
+
+  tbb_templates::CostModel slow;
+  slow.parallel_for(4, [](size_t) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  });
+  EXPECT_FALSE(slow.Serial(4));
+  EXPECT_EQ(slow.Grain(1000), 1);
+}
+
+TEST(TbbTemplates, functor_algorithms) {
+  std::vector<std::uint64_t> values(100000);
+  tbb_templates::parallel_for_blocked(
+      0, values.size(),
+      [&](size_t begin, size_t end) {
+        for (auto i = begin; i != end; ++i) values[i] = i;
+      },
+      1024, tbb_templates::Partitioner::kSimple);
+
+  auto sum = tbb_templates::parallel_reduce(
+      0, values.size(), std::uint64_t(0),
+      [&](size_t begin, size_t end, std::uint64_t init) {
+        for (auto i = begin; i != end; ++i) init += values[i];
+        return init;
+      },
+      std::plus<>());
+  EXPECT_EQ(sum, 99999ull * 100000 / 2);
+
+  std::vector<std::uint64_t> prefix(values.size());
+  auto total = tbb_templates::parallel_scan(
+      0, values.size(), std::uint64_t(0),
+      [&](size_t begin, size_t end, std::uint64_t running, bool is_final) {
+        for (auto i = begin; i != end; ++i) {
+          running += values[i];
+          if (is_final) prefix[i] = running;
+        }
+        return running;
+      },
+      std::plus<>());
+  EXPECT_EQ(total, sum);
+  EXPECT_EQ(prefix[10], 55);
+
+  tbb_templates::parallel_sort(values.begin(), values.end(), std::greater<>());
+  EXPECT_EQ(values.front(), 99999);
+
+  std::atomic<int> calls{0};
+  tbb_templates::parallel_invoke([&]() { ++calls; }, [&]() { ++calls; });
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(TbbTemplates, deterministic_blocks_keep_ranges) {
+  tbb_templates::set_deterministic(true);
+  auto run = [](size_t grain) {
+    std::vector<std::pair<size_t, size_t>> ranges(1000, {0, 0});
+    std::vector<std::uint64_t> keys(1000, 0);
+    tbb_templates::parallel_for_blocked(
+        0, 1000,
+        [&](size_t begin, size_t end) {
+          for (auto i = begin; i != end; ++i) {
+            ranges[i] = {begin, end};
+            keys[i] = tbb_templates::TaskKeyScope::Current().sub_key;
+          }
+        },
+        grain);
+    return std::make_pair(ranges, keys);
+  };
+  auto [ranges, keys] = run(1);
+  auto [big_ranges, big_keys] = run(200);
+  tbb_templates::set_deterministic(false);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    auto block = i / tbb_templates::kDeterministicGrain;
+    EXPECT_EQ(ranges[i].first, block * tbb_templates::kDeterministicGrain);
+    EXPECT_EQ(ranges[i].second,
+              std::min<size_t>(1000, ranges[i].first +
+                                         tbb_templates::kDeterministicGrain));
+    EXPECT_EQ(keys[i], keys[ranges[i].first]);
+    EXPECT_EQ(big_ranges[i].second - big_ranges[i].first, 200);
+  }
+  EXPECT_NE(keys[0], keys[999]);
+}
+
+TEST(DeferredQueue, out_of_scope_ties_replay_in_push_order) {
+  tbb_templates::set_deterministic(true);
+  ecs::DeferredQueue<int> queue;
+  for (int t = 0; t < 3; ++t)
+    std::thread([&queue, t]() {
+      for (int i = 0; i < 300; ++i) queue.push_back(t * 1000 + i);
+    }).join();
+  queue.Canonicalize();
+  tbb_templates::set_deterministic(false);
+
+  std::vector<int> order;
+  queue.ForEach([&](int value) { order.emplace_back(value); });
+  ASSERT_EQ(order.size(), 900);
+  for (int i = 0; i < 300; ++i)
+    for (int t = 0; t < 3; ++t) EXPECT_EQ(order[i * 3 + t], t * 1000 + i);
+}
+
+TEST(TbbTemplates, chase_lev_deque_steals_each_item_once) {
+  tbb_templates::ChaseLevDeque<int*> deque(4);
+  std::vector<int> items(10000);
+  std::vector<std::atomic<int>> seen(items.size());
+
+  std::atomic<bool> done{false};
+  std::thread thief([&]() {
+    while (!done || !deque.Empty())
+      if (auto item = deque.Steal(); item) ++seen[item - items.data()];
+  });
+  for (auto& item : items) {
+    deque.Push(&item);
+    if ((&item - items.data()) % 3 == 0)
+      if (auto popped = deque.Pop(); popped) ++seen[popped - items.data()];
+  }
+  while (auto popped = deque.Pop()) ++seen[popped - items.data()];
+  done = true;
+  thief.join();
+
+  for (auto& count : seen) EXPECT_EQ(count, 1);
+}
+
+TEST(TbbTemplates, pool_executor_runs_ecs_work) {
+  tbb_templates::PoolExecutor pool({.workers = 3});
+  tbb_templates::set_executor(&pool);
+
+  std::vector<int> values(50000, 1);
+  tbb_templates::parallel_for(values, [&](size_t i) { values[i] += int(i); });
+  auto sum = tbb_templates::parallel_reduce(
+      0, values.size(), std::int64_t(0),
+      [&](size_t begin, size_t end, std::int64_t init) {
+        for (auto i = begin; i != end; ++i) init += values[i];
+        return init;
+      },
+      std::plus<>());
+  EXPECT_EQ(sum, 50000ll + 49999ll * 50000 / 2);
+
+  std::atomic<int> calls{0};
+  tbb_templates::parallel_invoke([&]() { ++calls; }, [&]() { ++calls; },
+                                 [&]() { ++calls; });
+  EXPECT_EQ(calls, 3);
+
+  ecs::EntityManager_t ent_mgr;
+  std::vector<ecs::Entity_t> ents;
+  for (int i = 0; i < 100; ++i) {
+    auto& ent = ents.emplace_back(ent_mgr.CreateEntity());
+    ent_mgr.AddComponent<int>(ent) = i;
+    ent_mgr.AddComponent<float>(ent) = float(i);
+  }
+  ent_mgr.SyncSwap();
+  for (auto& ent : ents) *ent_mgr.ComponentW<int>(ent) += 1;
+  ent_mgr.SyncSwap();
+  EXPECT_EQ(*ent_mgr.ComponentR<int>(ents[10]), 11);
+
+  tbb_templates::set_executor(nullptr);
+}
@@ -10,6 +10,8 @@
 #include "test_file_system_utility.h"
 #include "test_string_manipulation.h"
 #include "test_entity_manager_simple.h"
+#include "test_entity_manager.h"
+#include "test_chunk_list.h"
 
 int main(int argc, char** args) {
   ::testing::InitGoogleTest(&argc, args);